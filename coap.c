@@ -4,6 +4,7 @@
 #include <stdbool.h>
 #include <string.h>
 #include <stddef.h>
+#include <stdarg.h>
 #include "coap.h"
 
 extern void endpoint_setup(void);
@@ -83,7 +84,7 @@ int coap_parseOption(coap_option_t *option, uint16_t *running_delta, const uint8
 {
     const uint8_t *p = *buf;
     uint8_t headlen = 1;
-    uint16_t len, delta;
+    uint32_t len, delta;
 
     if (buflen < headlen) // too small
         return COAP_ERR_OPTION_TOO_SHORT_FOR_HEADER;
@@ -91,7 +92,6 @@ int coap_parseOption(coap_option_t *option, uint16_t *running_delta, const uint8
     delta = (p[0] & 0xF0) >> 4;
     len = p[0] & 0x0F;
 
-    // These are untested and may be buggy
     if (delta == 13)
     {
         headlen++;
@@ -136,6 +136,10 @@ int coap_parseOption(coap_option_t *option, uint16_t *running_delta, const uint8
 
     if ((p + 1 + len) > (*buf + buflen))
         return COAP_ERR_OPTION_TOO_BIG;
+    if (len > COAP_LEN_MAX)
+        return COAP_ERR_OPTION_TOO_BIG;
+    if (delta + *running_delta > 0xFFFF)
+        return COAP_ERR_OPTION_DELTA_INVALID;
 
     //printf("option num=%d\n", delta + *running_delta);
     option->num = delta + *running_delta;
@@ -174,6 +178,8 @@ int coap_parseOptionsAndPayload(coap_option_t *options, uint8_t *numOptions, coa
 
     if (p+1 < end && *p == 0xFF)  // payload marker
     {
+        if ((size_t)(end-(p+1)) > COAP_LEN_MAX)
+            return COAP_ERR_PAYLOAD_TOO_BIG;
         payload->p = p+1;
         payload->len = end-(p+1);
     }
@@ -230,7 +236,7 @@ int coap_parse(coap_packet_t *pkt, const uint8_t *buf, size_t buflen)
 }
 
 // options are always stored consecutively, so can return a block with same option num
-const coap_option_t *coap_findOptions(const coap_packet_t *pkt, uint8_t num, uint8_t *count)
+const coap_option_t *coap_findOptions(const coap_packet_t *pkt, uint16_t num, uint8_t *count)
 {
     // FIXME, options is always sorted, can find faster than this
     size_t i;
@@ -294,14 +300,26 @@ int coap_build(uint8_t *buf, size_t *buflen, const coap_packet_t *pkt)
 
     for (i=0;i<pkt->numopts;i++)
     {
-        uint32_t optDelta;
-        uint8_t len, delta = 0;
+        uint32_t optDelta, optLen = pkt->opts[i].buf.len;
+        uint8_t len, delta;
+        size_t need;
 
-        if (((size_t)(p-buf)) > *buflen)
-             return COAP_ERR_BUFFER_TOO_SMALL;
+        // options must be sorted, coap_add_option() keeps them that way
+        if (pkt->opts[i].num < running_delta)
+            return COAP_ERR_OPTION_DELTA_INVALID;
         optDelta = pkt->opts[i].num - running_delta;
         coap_option_nibble(optDelta, &delta);
-        coap_option_nibble((uint32_t)pkt->opts[i].buf.len, &len);
+        coap_option_nibble(optLen, &len);
+        if (delta == 15)
+            return COAP_ERR_OPTION_DELTA_INVALID;
+        if (len == 15)
+            return COAP_ERR_OPTION_TOO_BIG;
+
+        need = 1 + optLen;
+        need += (delta == 13) ? 1 : (delta == 14) ? 2 : 0;
+        need += (len == 13) ? 1 : (len == 14) ? 2 : 0;
+        if (need > *buflen - (size_t)(p - buf))
+            return COAP_ERR_BUFFER_TOO_SMALL;
 
         *p++ = (0xFF & (delta << 4 | len));
         if (delta == 13)
@@ -316,17 +334,17 @@ int coap_build(uint8_t *buf, size_t *buflen, const coap_packet_t *pkt)
         }
         if (len == 13)
         {
-            *p++ = (pkt->opts[i].buf.len - 13);
+            *p++ = (optLen - 13);
         }
         else
         if (len == 14)
-  	    {
-            *p++ = (pkt->opts[i].buf.len >> 8);
-            *p++ = (0xFF & (pkt->opts[i].buf.len-269));
+        {
+            *p++ = ((optLen-269) >> 8);
+            *p++ = (0xFF & (optLen-269));
         }
 
-        memcpy(p, pkt->opts[i].buf.p, pkt->opts[i].buf.len);
-        p += pkt->opts[i].buf.len;
+        memcpy(p, pkt->opts[i].buf.p, optLen);
+        p += optLen;
         running_delta = pkt->opts[i].num;
     }
 
@@ -359,17 +377,82 @@ void coap_option_nibble(uint32_t value, uint8_t *nibble)
     {
         *nibble = 14;
     }
+    else
+    {
+        *nibble = 15;   // reserved, too big to encode
+    }
+}
+
+// Inserts an option keeping pkt->opts sorted by number, as coap_build()
+// requires. Repeated options keep the order they were added in.
+// The value is referenced, not copied.
+int coap_add_option(coap_packet_t *pkt, uint16_t num, const uint8_t *value, size_t len)
+{
+    uint8_t i;
+
+    if (pkt->numopts >= MAXOPT)
+        return COAP_ERR_TOO_MANY_OPTIONS;
+    if (len > COAP_LEN_MAX || len > 0xFFFF + 269)
+        return COAP_ERR_OPTION_TOO_BIG;
+
+    for (i = pkt->numopts; i > 0 && pkt->opts[i-1].num > num; i--)
+        pkt->opts[i] = pkt->opts[i-1];
+    pkt->opts[i].num = num;
+    pkt->opts[i].buf.p = value;
+    pkt->opts[i].buf.len = len;
+    pkt->numopts++;
+    return 0;
+}
+
+// For values that do not outlive the caller, the option points at a copy
+// taken from scratch
+int coap_add_option_copy(coap_arena_t *scratch, coap_packet_t *pkt, uint16_t num, const uint8_t *value, size_t len)
+{
+    coap_arena_mark_t mark = coap_arena_mark(scratch);
+    const uint8_t *p = NULL;
+    int rc;
+
+    if (len > 0 && NULL == (p = coap_arena_copy(scratch, value, len)))
+        return COAP_ERR_BUFFER_TOO_SMALL;
+    if (0 != (rc = coap_add_option(pkt, num, p, len)))
+        coap_arena_rollback(scratch, mark);
+    return rc;
 }
 
-int coap_make_response(coap_rw_buffer_t *scratch, coap_packet_t *pkt, const uint8_t *content, size_t content_len, uint8_t msgid_hi, uint8_t msgid_lo, const coap_buffer_t* tok, coap_responsecode_t rspcode, coap_content_type_t content_type)
+// http://tools.ietf.org/html/rfc7252#section-3.2
+// uint values go out in as few bytes as possible, 0 is zero length
+int coap_add_option_uint(coap_arena_t *scratch, coap_packet_t *pkt, uint16_t num, uint32_t value)
 {
+    uint8_t tmp[4];
+    uint8_t len = 0, i;
+    uint32_t v;
+
+    for (v = value; v != 0; v >>= 8)
+        len++;
+    for (i=0;i<len;i++)
+        tmp[i] = 0xFF & (value >> (8 * (len - 1 - i)));
+    return coap_add_option_copy(scratch, pkt, num, tmp, len);
+}
+
+int coap_make_response(coap_arena_t *scratch, coap_packet_t *pkt, const uint8_t *content, size_t content_len, uint8_t msgid_hi, uint8_t msgid_lo, const coap_buffer_t* tok, coap_responsecode_t rspcode, coap_content_type_t content_type)
+{
+    int rc;
+
+    // the packet is always fully initialised, even when an error is returned
     pkt->hdr.ver = 0x01;
     pkt->hdr.t = COAP_TYPE_ACK;
     pkt->hdr.tkl = 0;
     pkt->hdr.code = rspcode;
     pkt->hdr.id[0] = msgid_hi;
     pkt->hdr.id[1] = msgid_lo;
-    pkt->numopts = 1;
+    pkt->numopts = 0;
+    pkt->tok.p = NULL;
+    pkt->tok.len = 0;
+    pkt->payload.p = NULL;
+    pkt->payload.len = 0;
+
+    if (content_len > COAP_LEN_MAX)
+        return COAP_ERR_PAYLOAD_TOO_BIG;
 
     // need token in response
     if (tok) {
@@ -377,28 +460,53 @@ int coap_make_response(coap_rw_buffer_t *scratch, coap_packet_t *pkt, const uint
         pkt->tok = *tok;
     }
 
-    // safe because 1 < MAXOPT
-    pkt->opts[0].num = COAP_OPTION_CONTENT_FORMAT;
-    pkt->opts[0].buf.p = scratch->p;
-    if (scratch->len < 2)
-        return COAP_ERR_BUFFER_TOO_SMALL;
-    scratch->p[0] = ((uint16_t)content_type & 0xFF00) >> 8;
-    scratch->p[1] = ((uint16_t)content_type & 0x00FF);
-    pkt->opts[0].buf.len = 2;
+    if (content_type != COAP_CONTENTTYPE_NONE)
+    {
+        if (0 != (rc = coap_add_option_uint(scratch, pkt, COAP_OPTION_CONTENT_FORMAT, (uint16_t)content_type)))
+            return rc;
+    }
     pkt->payload.p = content;
     pkt->payload.len = content_len;
     return 0;
 }
 
+// message ids for the NON responses we originate
+static uint16_t msgid = 0;
+
+// http://tools.ietf.org/html/rfc7252#section-4.4, the first id should be
+// random so a restarted server does not reuse ids clients still remember
+void coap_seed_msgid(uint16_t seed)
+{
+    msgid = seed;
+}
+
+// http://tools.ietf.org/html/rfc7252#section-5.2.3
+// A NON request gets a NON response carrying a fresh message id,
+// handlers always build piggybacked ACKs so fix the type up here
+static int coap_fixup_type(const coap_packet_t *inpkt, coap_packet_t *outpkt, int rc)
+{
+    if (rc != 0 || inpkt->hdr.t != COAP_TYPE_NONCON || outpkt->hdr.t != COAP_TYPE_ACK)
+        return rc;
+    msgid++;
+    outpkt->hdr.t = COAP_TYPE_NONCON;
+    outpkt->hdr.id[0] = msgid >> 8;
+    outpkt->hdr.id[1] = msgid & 0xFF;
+    return rc;
+}
+
 // FIXME, if this looked in the table at the path before the method then
 // it could more easily return 405 errors
-int coap_handle_req(coap_rw_buffer_t *scratch, const coap_packet_t *inpkt, coap_packet_t *outpkt)
+int coap_handle_req(coap_arena_t *scratch, const coap_packet_t *inpkt, coap_packet_t *outpkt)
 {
     const coap_option_t *opt;
     uint8_t count;
     int i;
+    int rc;
     const coap_endpoint_t *ep = endpoints;
 
+    // everything handed out from scratch lives until the next request
+    coap_arena_reset(scratch);
+
     while(NULL != ep->handler)
     {
         if (ep->method != inpkt->hdr.code)
@@ -409,21 +517,92 @@ int coap_handle_req(coap_rw_buffer_t *scratch, const coap_packet_t *inpkt, coap_
                 goto next;
             for (i=0;i<count;i++)
             {
+                if (0 == strcmp(ep->path->elems[i], "*"))
+                    continue;
                 if (opt[i].buf.len != strlen(ep->path->elems[i]))
                     goto next;
                 if (0 != memcmp(ep->path->elems[i], opt[i].buf.p, opt[i].buf.len))
                     goto next;
             }
             // match!
-            return ep->handler(scratch, inpkt, outpkt, inpkt->hdr.id[0], inpkt->hdr.id[1]);
+            rc = ep->handler(scratch, inpkt, outpkt, inpkt->hdr.id[0], inpkt->hdr.id[1]);
+            return coap_fixup_type(inpkt, outpkt, rc);
         }
 next:
         ep++;
     }
 
-    coap_make_response(scratch, outpkt, NULL, 0, inpkt->hdr.id[0], inpkt->hdr.id[1], &inpkt->tok, COAP_RSPCODE_NOT_FOUND, COAP_CONTENTTYPE_NONE);
+    rc = coap_make_response(scratch, outpkt, NULL, 0, inpkt->hdr.id[0], inpkt->hdr.id[1], &inpkt->tok, COAP_RSPCODE_NOT_FOUND, COAP_CONTENTTYPE_NONE);
 
-    return 0;
+    return coap_fixup_type(inpkt, outpkt, rc);
+}
+
+void coap_arena_init(coap_arena_t *arena, uint8_t *mem, size_t size)
+{
+    arena->base = mem;
+    arena->size = size;
+    arena->used = 0;
+}
+
+// align must be a power of two, 0 or 1 for none. Returns NULL when the
+// arena is exhausted, nothing is freed individually.
+void *coap_arena_alloc(coap_arena_t *arena, size_t size, size_t align)
+{
+    size_t pad = 0;
+    uint8_t *p;
+
+    if (align > 1)
+        pad = (size_t)(-(uintptr_t)(arena->base + arena->used)) & (align - 1);
+    if (pad > arena->size - arena->used || size > arena->size - arena->used - pad)
+        return NULL;
+    p = arena->base + arena->used + pad;
+    arena->used += pad + size;
+    return p;
+}
+
+void *coap_arena_copy(coap_arena_t *arena, const void *src, size_t len)
+{
+    void *p = coap_arena_alloc(arena, len, 1);
+    if (NULL != p && len > 0)
+        memcpy(p, src, len);
+    return p;
+}
+
+// NUL terminated, *len (if given) excludes the terminator. Returns NULL and
+// takes nothing if the result does not fit.
+char *coap_arena_printf(coap_arena_t *arena, size_t *len, const char *fmt, ...)
+{
+    size_t avail = arena->size - arena->used;
+    char *p = (char *)arena->base + arena->used;
+    va_list ap;
+    int n;
+
+    va_start(ap, fmt);
+    n = vsnprintf(p, avail, fmt, ap);
+    va_end(ap);
+    if (n < 0 || (size_t)n >= avail)
+        return NULL;
+    arena->used += n + 1;
+    if (NULL != len)
+        *len = n;
+    return p;
+}
+
+coap_arena_mark_t coap_arena_mark(const coap_arena_t *arena)
+{
+    return arena->used;
+}
+
+// releases everything allocated since mark was taken
+void coap_arena_rollback(coap_arena_t *arena, coap_arena_mark_t mark)
+{
+    if (mark <= arena->used)
+        arena->used = mark;
+}
+
+void coap_arena_reset(coap_arena_t *arena)
+{
+    arena->used = 0;
 }
 
 void coap_setup(void)
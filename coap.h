@@ -9,7 +9,7 @@ extern "C" {
 #include <stdbool.h>
 #include <stddef.h>
 
-#define MAXOPT 16
+#include "coap_config.h"
 
 //http://tools.ietf.org/html/rfc7252#section-3
 typedef struct
@@ -26,7 +26,7 @@ typedef struct
 typedef struct
 {
     const uint8_t *p;
-    size_t len;
+    coap_len_t len;             /* width chosen by COAP_LEN_BYTES, see coap_config.h */
 } coap_buffer_t;
 
 typedef struct
@@ -35,9 +35,23 @@ typedef struct
     size_t len;
 } coap_rw_buffer_t;
 
+// Bump-pointer arena handed to handlers as scratch space. coap_handle_req()
+// resets it for every request, so anything allocated from it lives until
+// the response has been built and must not be kept beyond that.
+typedef struct
+{
+    uint8_t *base;              /* backing memory */
+    size_t size;                /* bytes available at base */
+    size_t used;                /* offset of the next free byte */
+} coap_arena_t;
+
+typedef size_t coap_arena_mark_t;
+
+#define COAP_ARENA_INIT(mem) {(mem), sizeof(mem), 0}
+
 typedef struct
 {
-    uint8_t num;                /* Option number. See http://tools.ietf.org/html/rfc7252#section-5.10 */
+    uint16_t num;               /* Option number. See http://tools.ietf.org/html/rfc7252#section-5.10 */
     coap_buffer_t buf;          /* Option value */
 } coap_option_t;
 
@@ -69,8 +83,12 @@ typedef enum
     COAP_OPTION_URI_QUERY = 15,
     COAP_OPTION_ACCEPT = 17,
     COAP_OPTION_LOCATION_QUERY = 20,
+    COAP_OPTION_BLOCK2 = 23,    // http://tools.ietf.org/html/rfc7959#section-2.1
+    COAP_OPTION_BLOCK1 = 27,
+    COAP_OPTION_SIZE2 = 28,
     COAP_OPTION_PROXY_URI = 35,
-    COAP_OPTION_PROXY_SCHEME = 39
+    COAP_OPTION_PROXY_SCHEME = 39,
+    COAP_OPTION_SIZE1 = 60
 } coap_option_num_t;
 
 //http://tools.ietf.org/html/rfc7252#section-12.1.1
@@ -96,10 +114,14 @@ typedef enum
 #define MAKE_RSPCODE(clas, det) ((clas << 5) | (det))
 typedef enum
 {
+    COAP_RSPCODE_CREATED = MAKE_RSPCODE(2, 1),
+    COAP_RSPCODE_DELETED = MAKE_RSPCODE(2, 2),
     COAP_RSPCODE_CONTENT = MAKE_RSPCODE(2, 5),
     COAP_RSPCODE_NOT_FOUND = MAKE_RSPCODE(4, 4),
     COAP_RSPCODE_BAD_REQUEST = MAKE_RSPCODE(4, 0),
-    COAP_RSPCODE_CHANGED = MAKE_RSPCODE(2, 4)
+    COAP_RSPCODE_CHANGED = MAKE_RSPCODE(2, 4),
+    COAP_RSPCODE_REQUEST_ENTITY_TOO_LARGE = MAKE_RSPCODE(4, 13),
+    COAP_RSPCODE_SERVICE_UNAVAILABLE = MAKE_RSPCODE(5, 3)
 } coap_responsecode_t;
 
 //http://tools.ietf.org/html/rfc7252#section-12.3
@@ -130,12 +152,14 @@ typedef enum
     COAP_ERR_BUFFER_TOO_SMALL = 9,
     COAP_ERR_UNSUPPORTED = 10,
     COAP_ERR_OPTION_DELTA_INVALID = 11,
+    COAP_ERR_PAYLOAD_TOO_BIG = 12,
+    COAP_ERR_NO_RESPONSE = 13,          // not a failure: handler asks for nothing to be sent
+    COAP_ERR_TOO_MANY_OPTIONS = 14,
 } coap_error_t;
 
 ///////////////////////
 
-typedef int (*coap_endpoint_func)(coap_rw_buffer_t *scratch, const coap_packet_t *inpkt, coap_packet_t *outpkt, uint8_t id_hi, uint8_t id_lo);
-#define MAX_SEGMENTS 2  // 2 = /foo/bar, 3 = /foo/bar/baz
+typedef int (*coap_endpoint_func)(coap_arena_t *scratch, const coap_packet_t *inpkt, coap_packet_t *outpkt, uint8_t id_hi, uint8_t id_lo);
 typedef struct
 {
     int count;
@@ -148,7 +172,8 @@ typedef struct
     coap_endpoint_func handler;         /* callback function which handles this 
                                          * type of endpoint (and calls 
                                          * coap_make_response() at some point) */
-    const coap_endpoint_path_t *path;   /* path towards a resource (i.e. foo/bar/) */ 
+    const coap_endpoint_path_t *path;   /* path towards a resource (i.e. foo/bar/),
+                                         * a "*" element matches any one segment */ 
     const char *core_attr;              /* the 'ct' attribute, as defined in RFC7252, section 7.2.1.:
                                          * "The Content-Format code "ct" attribute 
                                          * provides a hint about the 
@@ -161,13 +186,26 @@ typedef struct
 void coap_dumpPacket(coap_packet_t *pkt);
 int coap_parse(coap_packet_t *pkt, const uint8_t *buf, size_t buflen);
 int coap_buffer_to_string(char *strbuf, size_t strbuflen, const coap_buffer_t *buf);
-const coap_option_t *coap_findOptions(const coap_packet_t *pkt, uint8_t num, uint8_t *count);
+const coap_option_t *coap_findOptions(const coap_packet_t *pkt, uint16_t num, uint8_t *count);
 int coap_build(uint8_t *buf, size_t *buflen, const coap_packet_t *pkt);
 void coap_dump(const uint8_t *buf, size_t buflen, bool bare);
-int coap_make_response(coap_rw_buffer_t *scratch, coap_packet_t *pkt, const uint8_t *content, size_t content_len, uint8_t msgid_hi, uint8_t msgid_lo, const coap_buffer_t* tok, coap_responsecode_t rspcode, coap_content_type_t content_type);
-int coap_handle_req(coap_rw_buffer_t *scratch, const coap_packet_t *inpkt, coap_packet_t *outpkt);
+int coap_make_response(coap_arena_t *scratch, coap_packet_t *pkt, const uint8_t *content, size_t content_len, uint8_t msgid_hi, uint8_t msgid_lo, const coap_buffer_t* tok, coap_responsecode_t rspcode, coap_content_type_t content_type);
+void coap_arena_init(coap_arena_t *arena, uint8_t *mem, size_t size);
+void *coap_arena_alloc(coap_arena_t *arena, size_t size, size_t align);
+void *coap_arena_copy(coap_arena_t *arena, const void *src, size_t len);
+char *coap_arena_printf(coap_arena_t *arena, size_t *len, const char *fmt, ...);
+coap_arena_mark_t coap_arena_mark(const coap_arena_t *arena);
+void coap_arena_rollback(coap_arena_t *arena, coap_arena_mark_t mark);
+void coap_arena_reset(coap_arena_t *arena);
+// Options can be added in any order, but only after coap_make_response(),
+// which starts the packet with no options
+int coap_add_option(coap_packet_t *pkt, uint16_t num, const uint8_t *value, size_t len);
+int coap_add_option_copy(coap_arena_t *scratch, coap_packet_t *pkt, uint16_t num, const uint8_t *value, size_t len);
+int coap_add_option_uint(coap_arena_t *scratch, coap_packet_t *pkt, uint16_t num, uint32_t value);
+int coap_handle_req(coap_arena_t *scratch, const coap_packet_t *inpkt, coap_packet_t *outpkt);
 void coap_option_nibble(uint32_t value, uint8_t *nibble);
 void coap_setup(void);
+void coap_seed_msgid(uint16_t seed);
 void endpoint_setup(void);
 
 #ifdef __cplusplus
@@ -0,0 +1,213 @@
+#ifndef COAP_CONFIG_H
+#define COAP_CONFIG_H 1
+
+#include <stdint.h>
+#include <stddef.h>
+
+// Compile-time footprint profiles.
+//
+// Select one with -DCOAP_PROFILE=COAP_PROFILE_TINY (or _DEFAULT, _SERVER).
+// Every setting below can also be overridden individually with -D, the
+// profile only supplies the defaults.
+//
+//   tiny     2 KB RAM parts (AVR Arduino), small packets, no extras
+//   default  the POSIX demo, sized as microcoap always has been
+//   server   bigger option/path tables for gateway and host use
+#define COAP_PROFILE_TINY 1
+#define COAP_PROFILE_DEFAULT 2
+#define COAP_PROFILE_SERVER 3
+
+#ifndef COAP_PROFILE
+#ifdef __AVR__
+#define COAP_PROFILE COAP_PROFILE_TINY
+#else
+#define COAP_PROFILE COAP_PROFILE_DEFAULT
+#endif
+#endif
+
+#if COAP_PROFILE == COAP_PROFILE_TINY
+#define COAP_PROFILE_NAME "tiny"
+#ifndef MAXOPT
+#define MAXOPT 6                    // max options parsed per packet
+#endif
+#ifndef MAX_SEGMENTS
+#define MAX_SEGMENTS 2              // 2 = /foo/bar, 3 = /foo/bar/baz
+#endif
+#ifndef COAP_LEN_BYTES
+#define COAP_LEN_BYTES 1            // width of option/payload lengths
+#endif
+#ifndef COAP_WELLKNOWN_RSPLEN
+#define COAP_WELLKNOWN_RSPLEN 64    // /.well-known/core response buffer
+#endif
+#ifndef COAP_CONF_WELLKNOWN_CORE
+#define COAP_CONF_WELLKNOWN_CORE 1
+#endif
+#ifndef COAP_CONF_INGEST
+#define COAP_CONF_INGEST 0          // NON telemetry queue, needs C11 atomics
+#endif
+#ifndef COAP_CONF_RD
+#define COAP_CONF_RD 0              // RFC 9176 resource directory
+#endif
+#ifndef COAP_CONF_MULTICAST
+#define COAP_CONF_MULTICAST 0       // delayed responses to group requests
+#endif
+
+#elif COAP_PROFILE == COAP_PROFILE_DEFAULT
+#define COAP_PROFILE_NAME "default"
+#ifndef MAXOPT
+#define MAXOPT 16
+#endif
+#ifndef MAX_SEGMENTS
+#define MAX_SEGMENTS 2
+#endif
+#ifndef COAP_LEN_BYTES
+#define COAP_LEN_BYTES 2
+#endif
+#ifndef COAP_WELLKNOWN_RSPLEN
+#define COAP_WELLKNOWN_RSPLEN 512
+#endif
+#ifndef COAP_CONF_WELLKNOWN_CORE
+#define COAP_CONF_WELLKNOWN_CORE 1
+#endif
+#ifndef COAP_CONF_INGEST
+#define COAP_CONF_INGEST 0
+#endif
+#ifndef COAP_CONF_RD
+#define COAP_CONF_RD 0
+#endif
+#ifndef COAP_CONF_MULTICAST
+#define COAP_CONF_MULTICAST 0
+#endif
+
+#elif COAP_PROFILE == COAP_PROFILE_SERVER
+#define COAP_PROFILE_NAME "server"
+#ifndef MAXOPT
+#define MAXOPT 32
+#endif
+#ifndef MAX_SEGMENTS
+#define MAX_SEGMENTS 4
+#endif
+#ifndef COAP_LEN_BYTES
+#define COAP_LEN_BYTES 4
+#endif
+#ifndef COAP_WELLKNOWN_RSPLEN
+#define COAP_WELLKNOWN_RSPLEN 1500
+#endif
+#ifndef COAP_CONF_WELLKNOWN_CORE
+#define COAP_CONF_WELLKNOWN_CORE 1
+#endif
+#ifndef COAP_CONF_INGEST
+#define COAP_CONF_INGEST 1
+#endif
+#ifndef COAP_CONF_RD
+#define COAP_CONF_RD 1
+#endif
+#ifndef COAP_CONF_MULTICAST
+#define COAP_CONF_MULTICAST 1
+#endif
+
+#else
+#error "Unknown COAP_PROFILE"
+#endif
+
+// Length type used for option values and payloads held in a coap_packet_t
+#if COAP_LEN_BYTES == 1
+typedef uint8_t coap_len_t;
+#define COAP_LEN_MAX 0xFFU
+#elif COAP_LEN_BYTES == 2
+typedef uint16_t coap_len_t;
+#define COAP_LEN_MAX 0xFFFFU
+#elif COAP_LEN_BYTES == 4
+typedef uint32_t coap_len_t;
+#define COAP_LEN_MAX 0xFFFFFFFFUL
+#else
+#error "COAP_LEN_BYTES must be 1, 2 or 4"
+#endif
+
+#if COAP_CONF_INGEST
+#ifndef COAP_INGEST_QUEUE_LEN
+#define COAP_INGEST_QUEUE_LEN 256   // slots, must be a power of two
+#endif
+#ifndef COAP_INGEST_PAYLOAD_MAX
+#define COAP_INGEST_PAYLOAD_MAX 128 // larger payloads are rejected with 4.13
+#endif
+#ifndef COAP_INGEST_PATH_MAX
+#define COAP_INGEST_PATH_MAX 32     // Uri-Path copied as "a/b", truncated
+#endif
+#endif
+
+#if COAP_CONF_RD
+#ifndef COAP_RD_MAX_EPS
+#define COAP_RD_MAX_EPS 16384       // registrations
+#endif
+#ifndef COAP_RD_MAX_LINKS
+#define COAP_RD_MAX_LINKS 131072    // links across all registrations
+#endif
+#ifndef COAP_RD_MAX_VALUES
+#define COAP_RD_MAX_VALUES 262144   // indexed rt/if values across all links
+#endif
+#ifndef COAP_RD_BUCKETS
+#define COAP_RD_BUCKETS 65536       // per index hash table, power of two
+#endif
+#ifndef COAP_RD_NAME_LEN
+#define COAP_RD_NAME_LEN 64         // ep, d and base values incl. NUL
+#endif
+#ifndef COAP_RD_HREF_LEN
+#define COAP_RD_HREF_LEN 64         // link target incl. NUL
+#endif
+#ifndef COAP_RD_ATTR_LEN
+#define COAP_RD_ATTR_LEN 32         // rt and if values incl. NUL
+#endif
+#ifndef COAP_RD_BLOCK_SIZE
+#define COAP_RD_BLOCK_SIZE 512      // largest Block2 size served by lookups
+#endif
+#endif
+
+#if COAP_CONF_MULTICAST
+#ifndef COAP_MULTICAST_LEISURE_MS
+#define COAP_MULTICAST_LEISURE_MS 5000  // RFC 7252 section 8.2 default leisure
+#endif
+#ifndef COAP_MULTICAST_PENDING
+#define COAP_MULTICAST_PENDING 4    // responses waiting out their leisure
+#endif
+#ifndef COAP_MULTICAST_RSPLEN
+#define COAP_MULTICAST_RSPLEN 1152  // largest delayed response, RFC 7252 section 4.6
+#endif
+#endif
+
+// C89-friendly static assertion, usable at file scope
+#define COAP_STATIC_ASSERT_CAT_(a, b) a##b
+#define COAP_STATIC_ASSERT_CAT(a, b) COAP_STATIC_ASSERT_CAT_(a, b)
+#define COAP_STATIC_ASSERT(cond, msg) \
+    typedef char COAP_STATIC_ASSERT_CAT(coap_static_assert_##msg##_, __LINE__)[(cond) ? 1 : -1]
+
+COAP_STATIC_ASSERT(MAXOPT >= 1 && MAXOPT <= 255, maxopt_fits_numopts);
+COAP_STATIC_ASSERT(MAX_SEGMENTS >= 1, max_segments_positive);
+COAP_STATIC_ASSERT(sizeof(coap_len_t) <= sizeof(size_t), len_fits_size_t);
+#if COAP_CONF_WELLKNOWN_CORE
+// .well-known/core is itself two segments deep
+COAP_STATIC_ASSERT(MAX_SEGMENTS >= 2, wellknown_core_path_fits);
+// build_rsp() counts down with a uint16_t
+COAP_STATIC_ASSERT(COAP_WELLKNOWN_RSPLEN > 1 && COAP_WELLKNOWN_RSPLEN <= 0xFFFF, wellknown_rsplen_fits);
+COAP_STATIC_ASSERT(COAP_WELLKNOWN_RSPLEN <= COAP_LEN_MAX, wellknown_rsplen_fits_len_t);
+#endif
+#if COAP_CONF_INGEST
+COAP_STATIC_ASSERT((COAP_INGEST_QUEUE_LEN & (COAP_INGEST_QUEUE_LEN - 1)) == 0 && COAP_INGEST_QUEUE_LEN >= 2, ingest_queue_len_pow2);
+COAP_STATIC_ASSERT(COAP_INGEST_PAYLOAD_MAX <= COAP_LEN_MAX, ingest_payload_fits_len_t);
+COAP_STATIC_ASSERT(COAP_INGEST_PATH_MAX >= 2, ingest_path_max);
+#endif
+#if COAP_CONF_RD
+// /rd/{id} and /rd-lookup/res
+COAP_STATIC_ASSERT(MAX_SEGMENTS >= 2, rd_path_fits);
+COAP_STATIC_ASSERT((COAP_RD_BUCKETS & (COAP_RD_BUCKETS - 1)) == 0, rd_buckets_pow2);
+// Block2 sizes are 16 << szx, szx <= 6
+COAP_STATIC_ASSERT(COAP_RD_BLOCK_SIZE >= 16 && COAP_RD_BLOCK_SIZE <= 1024 && (COAP_RD_BLOCK_SIZE & (COAP_RD_BLOCK_SIZE - 1)) == 0, rd_block_size);
+COAP_STATIC_ASSERT(COAP_RD_BLOCK_SIZE <= COAP_LEN_MAX, rd_block_fits_len_t);
+#endif
+#if COAP_CONF_MULTICAST
+// pending responses are indexed with uint8_t
+COAP_STATIC_ASSERT(COAP_MULTICAST_PENDING >= 1 && COAP_MULTICAST_PENDING <= 255, multicast_pending);
+COAP_STATIC_ASSERT(COAP_MULTICAST_LEISURE_MS >= 1, multicast_leisure);
+#endif
+
+#endif
@@ -1,12 +1,22 @@
 #include <stdbool.h>
 #include <string.h>
 #include "coap.h"
+#if COAP_CONF_INGEST
+#include "ingest.h"
+#endif
+#if COAP_CONF_RD
+#include "rd.h"
+#endif
 
 static char light = '0';
 
-const uint16_t rsplen = 1500;
-static char rsp[1500] = "";
+#if COAP_CONF_WELLKNOWN_CORE
+const uint16_t rsplen = COAP_WELLKNOWN_RSPLEN;
+static char rsp[COAP_WELLKNOWN_RSPLEN] = "";
 void build_rsp(void);
+#else
+#define build_rsp()
+#endif
 
 #ifdef ARDUINO
 #include "Arduino.h"
@@ -20,23 +30,28 @@ void endpoint_setup(void)
 #include <stdio.h>
 void endpoint_setup(void)
 {
+#if COAP_CONF_RD
+    coap_rd_setup();
+#endif
     build_rsp();
 }
 #endif
 
+#if COAP_CONF_WELLKNOWN_CORE
 static const coap_endpoint_path_t path_well_known_core = {2, {".well-known", "core"}};
-static int handle_get_well_known_core(coap_rw_buffer_t *scratch, const coap_packet_t *inpkt, coap_packet_t *outpkt, uint8_t id_hi, uint8_t id_lo)
+static int handle_get_well_known_core(coap_arena_t *scratch, const coap_packet_t *inpkt, coap_packet_t *outpkt, uint8_t id_hi, uint8_t id_lo)
 {
     return coap_make_response(scratch, outpkt, (const uint8_t *)rsp, strlen(rsp), id_hi, id_lo, &inpkt->tok, COAP_RSPCODE_CONTENT, COAP_CONTENTTYPE_APPLICATION_LINKFORMAT);
 }
+#endif
 
 static const coap_endpoint_path_t path_light = {1, {"light"}};
-static int handle_get_light(coap_rw_buffer_t *scratch, const coap_packet_t *inpkt, coap_packet_t *outpkt, uint8_t id_hi, uint8_t id_lo)
+static int handle_get_light(coap_arena_t *scratch, const coap_packet_t *inpkt, coap_packet_t *outpkt, uint8_t id_hi, uint8_t id_lo)
 {
     return coap_make_response(scratch, outpkt, (const uint8_t *)&light, 1, id_hi, id_lo, &inpkt->tok, COAP_RSPCODE_CONTENT, COAP_CONTENTTYPE_TEXT_PLAIN);
 }
 
-static int handle_put_light(coap_rw_buffer_t *scratch, const coap_packet_t *inpkt, coap_packet_t *outpkt, uint8_t id_hi, uint8_t id_lo)
+static int handle_put_light(coap_arena_t *scratch, const coap_packet_t *inpkt, coap_packet_t *outpkt, uint8_t id_hi, uint8_t id_lo)
 {
     if (inpkt->payload.len == 0)
         return coap_make_response(scratch, outpkt, NULL, 0, id_hi, id_lo, &inpkt->tok, COAP_RSPCODE_BAD_REQUEST, COAP_CONTENTTYPE_TEXT_PLAIN);
@@ -62,18 +77,71 @@ static int handle_put_light(coap_rw_buffer_t *scratch, const coap_packet_t *inpk
     }
 }
 
+#if COAP_CONF_INGEST
+// POST readings here as NON, GET returns the queue counters
+static const coap_endpoint_path_t path_telemetry = {1, {"telemetry"}};
+static int handle_get_telemetry(coap_arena_t *scratch, const coap_packet_t *inpkt, coap_packet_t *outpkt, uint8_t id_hi, uint8_t id_lo)
+{
+    coap_ingest_stats_t st;
+    const char *txt;
+    size_t len;
+
+    coap_ingest_stats(&st);
+    txt = coap_arena_printf(scratch, &len, "depth=%lu hwm=%lu accepted=%lu consumed=%lu dropped=%lu toobig=%lu",
+        (unsigned long)st.depth, (unsigned long)st.high_water, (unsigned long)st.accepted,
+        (unsigned long)st.consumed, (unsigned long)st.dropped_full, (unsigned long)st.dropped_too_big);
+    if (NULL == txt)
+        return coap_make_response(scratch, outpkt, NULL, 0, id_hi, id_lo, &inpkt->tok, COAP_RSPCODE_SERVICE_UNAVAILABLE, COAP_CONTENTTYPE_NONE);
+    return coap_make_response(scratch, outpkt, (const uint8_t *)txt, len, id_hi, id_lo, &inpkt->tok, COAP_RSPCODE_CONTENT, COAP_CONTENTTYPE_TEXT_PLAIN);
+}
+#endif
+
+#if COAP_CONF_RD
+static const coap_endpoint_path_t path_rd = {1, {"rd"}};
+static const coap_endpoint_path_t path_rd_id = {2, {"rd", "*"}};
+static const coap_endpoint_path_t path_rd_lookup_ep = {2, {"rd-lookup", "ep"}};
+static const coap_endpoint_path_t path_rd_lookup_res = {2, {"rd-lookup", "res"}};
+#endif
+
 const coap_endpoint_t endpoints[] =
 {
+#if COAP_CONF_WELLKNOWN_CORE
     {COAP_METHOD_GET, handle_get_well_known_core, &path_well_known_core, "ct=40"},
+#endif
     {COAP_METHOD_GET, handle_get_light, &path_light, "ct=0"},
     {COAP_METHOD_PUT, handle_put_light, &path_light, NULL},
+#if COAP_CONF_INGEST
+    {COAP_METHOD_POST, coap_ingest_handle, &path_telemetry, NULL},
+    {COAP_METHOD_GET, handle_get_telemetry, &path_telemetry, "ct=0"},
+#endif
+#if COAP_CONF_RD
+    {COAP_METHOD_POST, coap_rd_handle_register, &path_rd, "rt=\"core.rd\";ct=40"},
+    {COAP_METHOD_POST, coap_rd_handle_update, &path_rd_id, NULL},
+    {COAP_METHOD_DELETE, coap_rd_handle_remove, &path_rd_id, NULL},
+    {COAP_METHOD_GET, coap_rd_handle_lookup_ep, &path_rd_lookup_ep, "rt=\"core.rd-lookup-ep\";ct=40"},
+    {COAP_METHOD_GET, coap_rd_handle_lookup_res, &path_rd_lookup_res, "rt=\"core.rd-lookup-res\";ct=40"},
+#endif
     {(coap_method_t)0, NULL, NULL, NULL}
 };
 
+#if COAP_CONF_WELLKNOWN_CORE
+// appends s if it fits in the len bytes left, false otherwise
+static bool rsp_append(uint16_t *len, const char *s)
+{
+    size_t n = strlen(s);
+    if (n > *len)
+        return false;
+    strcat(rsp, s);
+    *len -= n;
+    return true;
+}
+
+// Links that do not fit in rsp are left out whole
 void build_rsp(void)
 {
     uint16_t len = rsplen;
     const coap_endpoint_t *ep = endpoints;
+    size_t start;
     int i;
 
     len--; // Null-terminated string
@@ -85,29 +153,26 @@ void build_rsp(void)
             continue;
         }
 
-        if (0 < strlen(rsp)) {
-            strncat(rsp, ",", len);
-            len--;
-        }
+        start = strlen(rsp);
+        if (0 < start && !rsp_append(&len, ","))
+            break;
 
-        strncat(rsp, "<", len);
-        len--;
+        if (!rsp_append(&len, "<"))
+            goto full;
 
         for (i = 0; i < ep->path->count; i++) {
-            strncat(rsp, "/", len);
-            len--;
-
-            strncat(rsp, ep->path->elems[i], len);
-            len -= strlen(ep->path->elems[i]);
+            if (!rsp_append(&len, "/") || !rsp_append(&len, ep->path->elems[i]))
+                goto full;
         }
 
-        strncat(rsp, ">;", len);
-        len -= 2;
-
-        strncat(rsp, ep->core_attr, len);
-        len -= strlen(ep->core_attr);
+        if (!rsp_append(&len, ">;") || !rsp_append(&len, ep->core_attr))
+            goto full;
 
         ep++;
     }
-}
+    return;
 
+full:
+    rsp[start] = 0;
+}
+#endif
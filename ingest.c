@@ -0,0 +1,220 @@
+#include <stdint.h>
+#include <string.h>
+#include "ingest.h"
+
+#if COAP_CONF_INGEST
+
+#include <stdatomic.h>
+
+// Bounded MPMC ring, after Dmitry Vyukov's design. Every cell carries a
+// sequence number which tells producers and consumers whose turn it is,
+// so neither side ever takes a lock or waits on the other.
+#define QUEUE_MASK (COAP_INGEST_QUEUE_LEN - 1)
+
+typedef struct
+{
+    atomic_size_t seq;
+    coap_ingest_item_t item;
+} coap_ingest_cell_t;
+
+static coap_ingest_cell_t cells[COAP_INGEST_QUEUE_LEN];
+static atomic_size_t enqueue_pos;
+static atomic_size_t dequeue_pos;
+
+static atomic_uint_least32_t arrivals;
+static atomic_uint_least32_t accepted;
+static atomic_uint_least32_t consumed;
+static atomic_uint_least32_t dropped_full;
+static atomic_uint_least32_t dropped_too_big;
+static atomic_uint_least32_t high_water;
+
+static coap_ingest_reply_t reply_mode = COAP_INGEST_REPLY_NON;
+
+void coap_ingest_setup(coap_ingest_reply_t reply)
+{
+    size_t i;
+    for (i=0;i<COAP_INGEST_QUEUE_LEN;i++)
+        atomic_store_explicit(&cells[i].seq, i, memory_order_relaxed);
+    atomic_store_explicit(&enqueue_pos, 0, memory_order_relaxed);
+    atomic_store_explicit(&dequeue_pos, 0, memory_order_relaxed);
+    reply_mode = reply;
+    atomic_thread_fence(memory_order_release);
+}
+
+// claims a free cell, returns NULL if the ring is full
+static coap_ingest_cell_t *queue_reserve(size_t *slot)
+{
+    size_t pos = atomic_load_explicit(&enqueue_pos, memory_order_relaxed);
+
+    while(1)
+    {
+        coap_ingest_cell_t *cell = &cells[pos & QUEUE_MASK];
+        size_t seq = atomic_load_explicit(&cell->seq, memory_order_acquire);
+        intptr_t dif = (intptr_t)seq - (intptr_t)pos;
+
+        if (dif == 0)
+        {
+            if (atomic_compare_exchange_weak_explicit(&enqueue_pos, &pos, pos + 1, memory_order_relaxed, memory_order_relaxed))
+            {
+                *slot = pos;
+                return cell;
+            }
+            // pos was reloaded by the failed exchange
+        }
+        else
+        if (dif < 0)
+            return NULL;
+        else
+            pos = atomic_load_explicit(&enqueue_pos, memory_order_relaxed);
+    }
+}
+
+// hands a filled cell over to the consumers
+static void queue_commit(coap_ingest_cell_t *cell, size_t slot)
+{
+    size_t enq, deq;
+    uint32_t depth, hw;
+
+    atomic_store_explicit(&cell->seq, slot + 1, memory_order_release);
+
+    // with several producers and consumers our own slot may already have
+    // been drained, so measure the whole queue and ignore a stale reading
+    enq = atomic_load_explicit(&enqueue_pos, memory_order_relaxed);
+    deq = atomic_load_explicit(&dequeue_pos, memory_order_relaxed);
+    if (enq <= deq)
+        return;
+    depth = (uint32_t)(enq - deq);
+    if (depth > COAP_INGEST_QUEUE_LEN)
+        depth = COAP_INGEST_QUEUE_LEN;
+    hw = atomic_load_explicit(&high_water, memory_order_relaxed);
+    while (depth > hw && !atomic_compare_exchange_weak_explicit(&high_water, &hw, depth, memory_order_relaxed, memory_order_relaxed))
+        ;
+}
+
+static void fill_path(char *path, const coap_packet_t *inpkt)
+{
+    const coap_option_t *opt;
+    uint8_t count;
+    size_t used = 0;
+    int i;
+
+    path[0] = 0;
+    if (NULL == (opt = coap_findOptions(inpkt, COAP_OPTION_URI_PATH, &count)))
+        return;
+    for (i=0;i<count;i++)
+    {
+        size_t n = opt[i].buf.len;
+        if (i > 0 && used + 1 < COAP_INGEST_PATH_MAX)
+            path[used++] = '/';
+        if (n > COAP_INGEST_PATH_MAX - 1 - used)
+            n = COAP_INGEST_PATH_MAX - 1 - used;
+        memcpy(path + used, opt[i].buf.p, n);
+        used += n;
+    }
+    path[used] = 0;
+}
+
+static int32_t find_content_format(const coap_packet_t *inpkt)
+{
+    const coap_option_t *opt;
+    uint8_t count;
+    int32_t cf = 0;
+    size_t i;
+
+    if (NULL == (opt = coap_findOptions(inpkt, COAP_OPTION_CONTENT_FORMAT, &count)))
+        return -1;
+    if (opt->buf.len > 2)
+        return -1;
+    for (i=0;i<opt->buf.len;i++)
+        cf = (cf << 8) | opt->buf.p[i];
+    return cf;
+}
+
+int coap_ingest_handle(coap_arena_t *scratch, const coap_packet_t *inpkt, coap_packet_t *outpkt, uint8_t id_hi, uint8_t id_lo)
+{
+    coap_ingest_cell_t *cell;
+    coap_ingest_item_t *item;
+    size_t slot;
+    coap_responsecode_t rspcode = COAP_RSPCODE_CHANGED;
+    uint32_t seq = atomic_fetch_add_explicit(&arrivals, 1, memory_order_relaxed);
+
+    if (inpkt->payload.len > COAP_INGEST_PAYLOAD_MAX)
+    {
+        atomic_fetch_add_explicit(&dropped_too_big, 1, memory_order_relaxed);
+        rspcode = COAP_RSPCODE_REQUEST_ENTITY_TOO_LARGE;
+    }
+    else
+    if (NULL == (cell = queue_reserve(&slot)))
+    {
+        atomic_fetch_add_explicit(&dropped_full, 1, memory_order_relaxed);
+        rspcode = COAP_RSPCODE_SERVICE_UNAVAILABLE;
+    }
+    else
+    {
+        item = &cell->item;
+        item->seq = seq;
+        item->code = inpkt->hdr.code;
+        item->type = inpkt->hdr.t;
+        item->id[0] = id_hi;
+        item->id[1] = id_lo;
+        item->tkl = inpkt->tok.len;
+        if (item->tkl > 0)
+            memcpy(item->tok, inpkt->tok.p, item->tkl);
+        item->content_format = find_content_format(inpkt);
+        fill_path(item->path, inpkt);
+        item->len = inpkt->payload.len;
+        if (item->len > 0)
+            memcpy(item->payload, inpkt->payload.p, item->len);
+        queue_commit(cell, slot);
+        atomic_fetch_add_explicit(&accepted, 1, memory_order_relaxed);
+    }
+
+    if (inpkt->hdr.t == COAP_TYPE_NONCON && reply_mode == COAP_INGEST_REPLY_NONE)
+        return COAP_ERR_NO_RESPONSE;
+    return coap_make_response(scratch, outpkt, NULL, 0, id_hi, id_lo, &inpkt->tok, rspcode, COAP_CONTENTTYPE_NONE);
+}
+
+// Items are passed to fn in place and released once it returns, fn must
+// copy anything it wants to keep
+size_t coap_ingest_drain(coap_ingest_consumer_func fn, void *arg, size_t max)
+{
+    size_t n = 0;
+
+    while (n < max)
+    {
+        size_t pos = atomic_load_explicit(&dequeue_pos, memory_order_relaxed);
+        coap_ingest_cell_t *cell = &cells[pos & QUEUE_MASK];
+        size_t seq = atomic_load_explicit(&cell->seq, memory_order_acquire);
+        intptr_t dif = (intptr_t)seq - (intptr_t)(pos + 1);
+
+        if (dif < 0)
+            break;  // empty
+        if (dif > 0)
+            continue;   // another consumer got there first
+        if (!atomic_compare_exchange_weak_explicit(&dequeue_pos, &pos, pos + 1, memory_order_relaxed, memory_order_relaxed))
+            continue;
+
+        fn(&cell->item, arg);
+        atomic_store_explicit(&cell->seq, pos + QUEUE_MASK + 1, memory_order_release);
+        n++;
+    }
+
+    if (n > 0)
+        atomic_fetch_add_explicit(&consumed, n, memory_order_relaxed);
+    return n;
+}
+
+void coap_ingest_stats(coap_ingest_stats_t *stats)
+{
+    size_t enq = atomic_load_explicit(&enqueue_pos, memory_order_relaxed);
+    size_t deq = atomic_load_explicit(&dequeue_pos, memory_order_relaxed);
+
+    stats->depth = (enq > deq) ? (uint32_t)(enq - deq) : 0;
+    stats->high_water = atomic_load_explicit(&high_water, memory_order_relaxed);
+    stats->accepted = atomic_load_explicit(&accepted, memory_order_relaxed);
+    stats->consumed = atomic_load_explicit(&consumed, memory_order_relaxed);
+    stats->dropped_full = atomic_load_explicit(&dropped_full, memory_order_relaxed);
+    stats->dropped_too_big = atomic_load_explicit(&dropped_too_big, memory_order_relaxed);
+}
+
+#endif
@@ -0,0 +1,63 @@
+#ifndef INGEST_H
+#define INGEST_H 1
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "coap.h"
+
+#if COAP_CONF_INGEST
+
+// Telemetry ingestion for NON uploads.
+//
+// Endpoints using coap_ingest_handle() as their handler copy the request
+// payload and some metadata into a bounded lock-free queue and reply at
+// once. Consumer threads call coap_ingest_drain() to take items off in
+// batches, so storage never blocks the receive loop. Any number of
+// receive threads may push and any number of consumers may drain.
+
+typedef enum
+{
+    COAP_INGEST_REPLY_NON = 0,  /* answer NON requests with a NON 2.04 (or an error) */
+    COAP_INGEST_REPLY_NONE = 1  /* send nothing back for NON requests */
+} coap_ingest_reply_t;
+
+typedef struct
+{
+    uint32_t seq;                           /* arrival counter, gaps mean drops */
+    uint8_t code;                           /* request method */
+    uint8_t type;                           /* CON or NON */
+    uint8_t id[2];                          /* message id */
+    uint8_t tkl;                            /* token length */
+    uint8_t tok[8];                         /* token value */
+    int32_t content_format;                 /* Content-Format option, -1 if absent */
+    char path[COAP_INGEST_PATH_MAX];        /* Uri-Path as "a/b", NUL terminated */
+    coap_len_t len;                         /* payload length */
+    uint8_t payload[COAP_INGEST_PAYLOAD_MAX];
+} coap_ingest_item_t;
+
+typedef struct
+{
+    uint32_t depth;             /* items waiting for a consumer */
+    uint32_t high_water;        /* largest depth seen */
+    uint32_t accepted;          /* items queued */
+    uint32_t consumed;          /* items handed to consumers */
+    uint32_t dropped_full;      /* rejected because the queue was full */
+    uint32_t dropped_too_big;   /* rejected because the payload did not fit */
+} coap_ingest_stats_t;
+
+typedef void (*coap_ingest_consumer_func)(const coap_ingest_item_t *item, void *arg);
+
+void coap_ingest_setup(coap_ingest_reply_t reply);
+int coap_ingest_handle(coap_arena_t *scratch, const coap_packet_t *inpkt, coap_packet_t *outpkt, uint8_t id_hi, uint8_t id_lo);
+size_t coap_ingest_drain(coap_ingest_consumer_func fn, void *arg, size_t max);
+void coap_ingest_stats(coap_ingest_stats_t *stats);
+
+#endif
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -0,0 +1,312 @@
+#ifdef LOSSY
+
+#include <errno.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "lossy.h"
+
+#define LOSSY_SLOTS 256     // datagrams in flight through the delay line
+#define LOSSY_MTU 4096
+
+typedef struct
+{
+    bool used;
+    bool inbound;
+    int fd;
+    uint64_t due;           // monotonic us
+    size_t len;
+    struct sockaddr_storage addr;
+    socklen_t addrlen;
+    uint8_t data[LOSSY_MTU];
+} lossy_slot_t;
+
+static lossy_slot_t slots[LOSSY_SLOTS];
+static lossy_config_t config;
+static lossy_stats_t stats[2];      // [0] outbound, [1] inbound
+static uint64_t link_free[2];       // when each direction finishes serialising
+static uint64_t rng = 1;
+
+static uint64_t now_us(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+// xorshift64*, uniform in [0, 1)
+static double rnd(void)
+{
+    rng ^= rng >> 12;
+    rng ^= rng << 25;
+    rng ^= rng >> 27;
+    return (double)((rng * 2685821657736338717ULL) >> 11) / (double)(1ULL << 53);
+}
+
+int lossy_parse(lossy_config_t *cfg, const char *spec)
+{
+    char tmp[256];
+    char *tok, *save = NULL;
+
+    if (NULL == spec)
+        return 0;
+    if (strlen(spec) >= sizeof(tmp))
+        return -1;
+    strcpy(tmp, spec);
+
+    for (tok = strtok_r(tmp, ",", &save); tok != NULL; tok = strtok_r(NULL, ",", &save))
+    {
+        char *val = strchr(tok, '=');
+        if (NULL == val)
+            return -1;
+        *val++ = 0;
+        if (0 == strcmp(tok, "loss"))
+            cfg->loss = atof(val);
+        else if (0 == strcmp(tok, "dup"))
+            cfg->dup = atof(val);
+        else if (0 == strcmp(tok, "reorder"))
+            cfg->reorder = atof(val);
+        else if (0 == strcmp(tok, "delay"))
+            cfg->delay_ms = strtoul(val, NULL, 10);
+        else if (0 == strcmp(tok, "jitter"))
+            cfg->jitter_ms = strtoul(val, NULL, 10);
+        else if (0 == strcmp(tok, "reorder_delay"))
+            cfg->reorder_ms = strtoul(val, NULL, 10);
+        else if (0 == strcmp(tok, "rate"))
+            cfg->rate_bps = strtoul(val, NULL, 10);
+        else if (0 == strcmp(tok, "seed"))
+            cfg->seed = strtoul(val, NULL, 10);
+        else
+            return -1;
+    }
+    return 0;
+}
+
+void lossy_setup(const lossy_config_t *cfg)
+{
+    config = *cfg;
+    if (config.reorder > 0 && config.reorder_ms == 0)
+        config.reorder_ms = config.delay_ms + config.jitter_ms + 10;
+    rng = config.seed ? config.seed : 1;
+    memset(slots, 0, sizeof(slots));
+    memset(stats, 0, sizeof(stats));
+    link_free[0] = link_free[1] = 0;
+}
+
+void lossy_stats(lossy_stats_t *in, lossy_stats_t *out)
+{
+    if (in)
+        *in = stats[1];
+    if (out)
+        *out = stats[0];
+}
+
+// runs one datagram through the impairments and onto the delay line
+static void impair(bool inbound, int fd, const void *buf, size_t len, const struct sockaddr *addr, socklen_t addrlen)
+{
+    lossy_stats_t *st = &stats[inbound];
+    int copies = 1;
+
+    st->passed++;
+    if (rnd() < config.loss)
+    {
+        st->dropped++;
+        return;
+    }
+    if (rnd() < config.dup)
+    {
+        st->duplicated++;
+        copies = 2;
+    }
+
+    while (copies--)
+    {
+        uint64_t now = now_us();
+        uint64_t due = now;
+        size_t i;
+
+        if (config.rate_bps > 0)
+        {
+            if (link_free[inbound] < now)
+                link_free[inbound] = now;
+            link_free[inbound] += (uint64_t)len * 8 * 1000000 / config.rate_bps;
+            due = link_free[inbound];
+        }
+        due += (uint64_t)config.delay_ms * 1000;
+        if (config.jitter_ms > 0)
+            due += (uint64_t)(rnd() * config.jitter_ms * 1000);
+        if (config.reorder > 0 && rnd() < config.reorder)
+        {
+            st->reordered++;
+            due += (uint64_t)config.reorder_ms * 1000;
+        }
+
+        for (i=0;i<LOSSY_SLOTS;i++)
+            if (!slots[i].used)
+                break;
+        if (i == LOSSY_SLOTS || len > LOSSY_MTU || addrlen > sizeof(slots[i].addr))
+        {
+            st->overflow++;
+            continue;
+        }
+        slots[i].used = true;
+        slots[i].inbound = inbound;
+        slots[i].fd = fd;
+        slots[i].due = due;
+        slots[i].len = len;
+        memcpy(&slots[i].addr, addr, addrlen);
+        slots[i].addrlen = addrlen;
+        memcpy(slots[i].data, buf, len);
+    }
+}
+
+// earliest due slot matching direction (and fd, if fd >= 0), or NULL
+static lossy_slot_t *earliest(bool inbound, int fd, uint64_t before)
+{
+    lossy_slot_t *best = NULL;
+    size_t i;
+
+    for (i=0;i<LOSSY_SLOTS;i++)
+    {
+        if (!slots[i].used || slots[i].inbound != inbound || slots[i].due > before)
+            continue;
+        if (fd >= 0 && slots[i].fd != fd)
+            continue;
+        if (NULL == best || slots[i].due < best->due)
+            best = &slots[i];
+    }
+    return best;
+}
+
+static void flush_out(void)
+{
+    uint64_t now = now_us();
+    lossy_slot_t *s;
+
+    while (NULL != (s = earliest(false, -1, now)))
+    {
+        sendto(s->fd, s->data, s->len, 0, (struct sockaddr *)&s->addr, s->addrlen);
+        s->used = false;
+    }
+}
+
+static uint64_t next_due(void)
+{
+    uint64_t due = UINT64_MAX;
+    size_t i;
+
+    for (i=0;i<LOSSY_SLOTS;i++)
+        if (slots[i].used && slots[i].due < due)
+            due = slots[i].due;
+    return due;
+}
+
+ssize_t lossy_sendto(int fd, const void *buf, size_t len, int flags, const struct sockaddr *addr, socklen_t addrlen)
+{
+    (void)flags;
+    impair(false, fd, buf, len, addr, addrlen);
+    flush_out();
+    return len;
+}
+
+int lossy_poll(struct pollfd *fds, nfds_t nfds, int timeout)
+{
+    uint64_t deadline = (timeout < 0) ? UINT64_MAX : now_us() + (uint64_t)timeout * 1000;
+
+    while(1)
+    {
+        uint64_t now, wake;
+        int ready = 0, wait_ms, rc;
+        nfds_t i;
+
+        flush_out();
+        now = now_us();
+        for (i=0;i<nfds;i++)
+        {
+            fds[i].revents = 0;
+            if ((fds[i].events & POLLIN) && NULL != earliest(true, fds[i].fd, now))
+            {
+                fds[i].revents = POLLIN;
+                ready++;
+            }
+        }
+        if (ready > 0)
+            return ready;
+        if (now >= deadline)
+            return 0;
+
+        wake = next_due();
+        if (deadline < wake)
+            wake = deadline;
+        wait_ms = (wake == UINT64_MAX) ? -1 : (int)((wake - now + 999) / 1000);
+
+        if ((rc = poll(fds, nfds, wait_ms)) < 0)
+            return rc;
+
+        // pull everything that arrived into the delay line
+        for (i=0;i<nfds;i++)
+        {
+            if (fds[i].revents & POLLIN)
+            {
+                uint8_t buf[LOSSY_MTU];
+                struct sockaddr_storage addr;
+                socklen_t addrlen = sizeof(addr);
+                ssize_t n;
+
+                while ((n = recvfrom(fds[i].fd, buf, sizeof(buf), MSG_DONTWAIT, (struct sockaddr *)&addr, &addrlen)) >= 0)
+                {
+                    impair(true, fds[i].fd, buf, n, (struct sockaddr *)&addr, addrlen);
+                    addrlen = sizeof(addr);
+                }
+            }
+            else
+            if (fds[i].revents != 0)
+                ready++;
+        }
+        if (ready > 0)
+            return ready;
+    }
+}
+
+ssize_t lossy_recvfrom(int fd, void *buf, size_t len, int flags, struct sockaddr *addr, socklen_t *addrlen)
+{
+    while(1)
+    {
+        lossy_slot_t *s = earliest(true, fd, now_us());
+        struct pollfd pfd;
+        int rc;
+
+        if (NULL != s)
+        {
+            size_t n = (s->len < len) ? s->len : len;
+            memcpy(buf, s->data, n);
+            if (addr && addrlen)
+            {
+                socklen_t alen = (s->addrlen < *addrlen) ? s->addrlen : *addrlen;
+                memcpy(addr, &s->addr, alen);
+                *addrlen = s->addrlen;
+            }
+            s->used = false;
+            return n;
+        }
+
+        pfd.fd = fd;
+        pfd.events = POLLIN;
+        if ((rc = lossy_poll(&pfd, 1, (flags & MSG_DONTWAIT) ? 0 : -1)) < 0)
+            return -1;
+        if (rc == 0)
+        {
+            errno = EAGAIN;
+            return -1;
+        }
+        if (pfd.revents & ~POLLIN)
+        {
+            errno = EIO;
+            return -1;
+        }
+    }
+}
+
+#endif
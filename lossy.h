@@ -0,0 +1,59 @@
+#ifndef LOSSY_H
+#define LOSSY_H 1
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// In-process network impairment shim for the POSIX server.
+//
+// Build with -DLOSSY (make LOSSY=1) and main-posix.c routes recvfrom() and
+// sendto() through here. Each direction independently suffers loss,
+// duplication, reordering, delay with jitter and a bandwidth cap, so a
+// request/response exchange on loopback sees the same impairment twice,
+// like a real lossy link would.
+
+#include <stdint.h>
+#include <poll.h>
+#include <sys/types.h>
+#include <sys/socket.h>
+
+typedef struct
+{
+    double loss;            /* probability a datagram is dropped */
+    double dup;             /* probability a datagram is delivered twice */
+    double reorder;         /* probability a datagram is held back by reorder_ms */
+    uint32_t delay_ms;      /* one-way base delay */
+    uint32_t jitter_ms;     /* uniform extra delay in [0, jitter_ms] */
+    uint32_t reorder_ms;    /* hold-back for reordered datagrams */
+    uint32_t rate_bps;      /* bandwidth cap in bits per second, 0 for none */
+    uint32_t seed;          /* PRNG seed, same seed gives the same run */
+} lossy_config_t;
+
+typedef struct
+{
+    uint32_t passed;        /* datagrams offered to the shim */
+    uint32_t dropped;       /* lost on purpose */
+    uint32_t duplicated;    /* extra copies created */
+    uint32_t reordered;     /* held back to let later datagrams overtake */
+    uint32_t overflow;      /* lost because the delay line was full */
+} lossy_stats_t;
+
+// spec is "loss=0.2,dup=0.01,reorder=0.1,delay=20,jitter=10,reorder_delay=50,rate=250000,seed=1"
+// unknown keys fail, missing keys keep their current value
+int lossy_parse(lossy_config_t *cfg, const char *spec);
+void lossy_setup(const lossy_config_t *cfg);
+void lossy_stats(lossy_stats_t *in, lossy_stats_t *out);
+
+// drop-in replacements, recvfrom blocks until a datagram is deliverable
+// unless MSG_DONTWAIT is set
+ssize_t lossy_sendto(int fd, const void *buf, size_t len, int flags, const struct sockaddr *addr, socklen_t addrlen);
+ssize_t lossy_recvfrom(int fd, void *buf, size_t len, int flags, struct sockaddr *addr, socklen_t *addrlen);
+// poll() that also runs the delay line and reports POLLIN for datagrams due
+int lossy_poll(struct pollfd *fds, nfds_t nfds, int timeout);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
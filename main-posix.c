@@ -1,13 +1,225 @@
 #include <sys/socket.h>
 #include <netinet/in.h>
+#include <arpa/inet.h>
+#include <ifaddrs.h>
+#include <net/if.h>
+#include <poll.h>
+#include <pthread.h>
+#include <signal.h>
 #include <stdio.h>
 #include <stdbool.h>
+#include <stdlib.h>
+#include <string.h>
 #include <strings.h>
+#include <time.h>
+#include <unistd.h>
 
 #include "coap.h"
+#if COAP_CONF_INGEST
+#include "ingest.h"
+#endif
+#if COAP_CONF_RD
+#include "rd.h"
+#endif
+#if COAP_CONF_MULTICAST
+#include "mcast.h"
+#endif
+#ifdef LOSSY
+#include "lossy.h"
+#define recvfrom lossy_recvfrom
+#define sendto lossy_sendto
+#define poll lossy_poll
+#endif
 
 #define PORT 5683
 
+#if COAP_CONF_MULTICAST
+// All CoAP Nodes, http://tools.ietf.org/html/rfc7252#section-12.8
+#ifdef IPV6
+static const char *mcast_groups[] = {"ff02::fd", "ff05::fd"};
+#else /* IPV6 */
+static const char *mcast_groups[] = {"224.0.1.187"};
+#endif /* IPV6 */
+#define MCAST_GROUPS (sizeof(mcast_groups) / sizeof(mcast_groups[0]))
+
+static uint32_t now_ms(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint32_t)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+#ifdef IPV6
+// First interface that is up, multicast capable, not loopback and has an
+// IPv6 address, 0 if there is none. Link-local groups cannot leave the
+// choice to the system.
+static unsigned int mcast_default_if(void)
+{
+    struct ifaddrs *ifa, *p;
+    unsigned int ifindex = 0;
+
+    if (0 != getifaddrs(&ifa))
+        return 0;
+    for (p = ifa; NULL != p && 0 == ifindex; p = p->ifa_next)
+    {
+        if (NULL == p->ifa_addr || p->ifa_addr->sa_family != AF_INET6)
+            continue;
+        if ((p->ifa_flags & (IFF_UP | IFF_MULTICAST | IFF_LOOPBACK)) == (IFF_UP | IFF_MULTICAST))
+            ifindex = if_nametoindex(p->ifa_name);
+    }
+    freeifaddrs(ifa);
+    return ifindex;
+}
+#endif /* IPV6 */
+
+// A socket bound to the group address only sees requests sent to the
+// group, which is how they are told apart from unicast ones. ifindex 0
+// leaves the choice of interface to the system.
+static int mcast_open(const char *group, unsigned int ifindex)
+{
+    struct group_req req;
+    int on = 1;
+    int fd;
+#ifdef IPV6
+    struct sockaddr_in6 addr;
+
+    bzero(&addr, sizeof(addr));
+    addr.sin6_family = AF_INET6;
+    addr.sin6_port = htons(PORT);
+    addr.sin6_scope_id = ifindex;
+    if (1 != inet_pton(AF_INET6, group, &addr.sin6_addr))
+        return -1;
+    // link-local groups need to know their link
+    if (IN6_IS_ADDR_MC_LINKLOCAL(&addr.sin6_addr) && ifindex == 0)
+    {
+        if (0 == (ifindex = mcast_default_if()))
+            return -1;
+        addr.sin6_scope_id = ifindex;
+    }
+    fd = socket(AF_INET6, SOCK_DGRAM, 0);
+#else /* IPV6 */
+    struct sockaddr_in addr;
+
+    bzero(&addr, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(PORT);
+    if (1 != inet_pton(AF_INET, group, &addr.sin_addr))
+        return -1;
+    fd = socket(AF_INET, SOCK_DGRAM, 0);
+#endif /* IPV6 */
+    if (fd < 0)
+        return -1;
+
+    bzero(&req, sizeof(req));
+    req.gr_interface = ifindex;
+    memcpy(&req.gr_group, &addr, sizeof(addr));
+    if (0 != setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on)) ||
+        0 != bind(fd, (struct sockaddr *)&addr, sizeof(addr)) ||
+#ifdef IPV6
+        0 != setsockopt(fd, IPPROTO_IPV6, MCAST_JOIN_GROUP, &req, sizeof(req)))
+#else /* IPV6 */
+        0 != setsockopt(fd, IPPROTO_IP, MCAST_JOIN_GROUP, &req, sizeof(req)))
+#endif /* IPV6 */
+    {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+// responses leave from the unicast socket, never from the group address
+static void mcast_send(const uint8_t *data, size_t len, const void *peer, size_t peerlen, void *arg)
+{
+    sendto(*(const int *)arg, data, len, 0, (const struct sockaddr *)peer, peerlen);
+}
+#else
+#define MCAST_GROUPS 0
+#endif
+
+#ifdef LOSSY
+// remembers recent exchanges so handler runs caused by retransmissions
+// and duplicated datagrams can be counted
+#define SEEN_LEN 256
+static uint32_t seen[SEEN_LEN];
+static size_t seen_next = 0;
+static unsigned long handled = 0, duplicates = 0;
+static volatile sig_atomic_t stop = 0;
+
+static void on_signal(int sig)
+{
+    (void)sig;
+    stop = 1;
+}
+
+static bool lossy_seen(const void *addr, socklen_t addrlen, const coap_packet_t *pkt)
+{
+    const uint8_t *p = (const uint8_t *)addr;
+    uint32_t h = 2166136261u;   // FNV-1a over peer and message id
+    socklen_t i;
+    size_t j;
+
+    for (i=0;i<addrlen;i++)
+        h = (h ^ p[i]) * 16777619u;
+    h = (h ^ pkt->hdr.id[0]) * 16777619u;
+    h = (h ^ pkt->hdr.id[1]) * 16777619u;
+
+    for (j=0;j<SEEN_LEN;j++)
+        if (seen[j] == h)
+            return true;
+    seen[seen_next++ % SEEN_LEN] = h;
+    return false;
+}
+
+static void lossy_report(void)
+{
+    lossy_stats_t in, out;
+
+    lossy_stats(&in, &out);
+    printf("lossy: handled=%lu duplicates=%lu\n", handled, duplicates);
+    printf("lossy: in passed=%u dropped=%u duplicated=%u reordered=%u overflow=%u\n",
+        in.passed, in.dropped, in.duplicated, in.reordered, in.overflow);
+    printf("lossy: out passed=%u dropped=%u duplicated=%u reordered=%u overflow=%u\n",
+        out.passed, out.dropped, out.duplicated, out.reordered, out.overflow);
+}
+#endif
+
+#if COAP_CONF_INGEST
+#define INGEST_BATCH 32
+#define INGEST_LOG "telemetry.log"
+
+static void ingest_write(const coap_ingest_item_t *item, void *arg)
+{
+    FILE *f = (FILE *)arg;
+    coap_len_t i;
+
+    fprintf(f, "%lu %s ct=%ld ", (unsigned long)item->seq, item->path, (long)item->content_format);
+    for (i=0;i<item->len;i++)
+        fprintf(f, "%02X", item->payload[i]);
+    fprintf(f, "\n");
+}
+
+// drains the ingestion queue into a log file, one flush per batch
+static void *ingest_consumer(void *arg)
+{
+    FILE *f = fopen(INGEST_LOG, "a");
+    const struct timespec idle = {0, 1000000};
+
+    if (NULL == f)
+    {
+        perror(INGEST_LOG);
+        return NULL;
+    }
+    while(1)
+    {
+        if (0 == coap_ingest_drain(ingest_write, f, INGEST_BATCH))
+            nanosleep(&idle, NULL);
+        else
+            fflush(f);
+    }
+    return NULL;
+}
+#endif
+
 int main(int argc, char **argv)
 {
     int fd;
@@ -18,7 +230,9 @@ int main(int argc, char **argv)
 #endif /* IPV6 */
     uint8_t buf[4096];
     uint8_t scratch_raw[4096];
-    coap_rw_buffer_t scratch_buf = {scratch_raw, sizeof(scratch_raw)};
+    coap_arena_t scratch_buf = COAP_ARENA_INIT(scratch_raw);
+    struct pollfd pfd[1 + MCAST_GROUPS];
+    nfds_t nfds = 1;
 
 #ifdef IPV6
     fd = socket(AF_INET6,SOCK_DGRAM,0);
@@ -36,17 +250,130 @@ int main(int argc, char **argv)
     servaddr.sin_addr.s_addr = htonl(INADDR_ANY);
     servaddr.sin_port = htons(PORT);
 #endif /* IPV6 */
+#if COAP_CONF_MULTICAST
+    {
+        // share the port with the group sockets
+        int on = 1;
+        setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+#if defined(IP_MULTICAST_ALL) && !defined(IPV6)
+        // Linux otherwise hands this socket a copy of every group datagram
+        on = 0;
+        setsockopt(fd, IPPROTO_IP, IP_MULTICAST_ALL, &on, sizeof(on));
+#endif
+#if defined(IPV6_MULTICAST_ALL) && defined(IPV6)
+        on = 0;
+        setsockopt(fd, IPPROTO_IPV6, IPV6_MULTICAST_ALL, &on, sizeof(on));
+#endif
+    }
+#endif
     bind(fd,(struct sockaddr *)&servaddr, sizeof(servaddr));
+    pfd[0].fd = fd;
+    pfd[0].events = POLLIN;
+
+#if COAP_CONF_MULTICAST
+    {
+        // COAP_MCAST_IF picks the interface to join on, by name. Without it
+        // the system chooses, except for link-local groups, see mcast_default_if()
+        const char *ifname = getenv("COAP_MCAST_IF");
+        unsigned int ifindex = (NULL != ifname) ? if_nametoindex(ifname) : 0;
+        size_t i;
+
+        if (NULL != ifname && 0 == ifindex)
+            printf("Unknown interface %s\n", ifname);
+        for (i=0;i<MCAST_GROUPS;i++)
+        {
+            int mfd = mcast_open(mcast_groups[i], ifindex);
+            if (mfd < 0)
+            {
+                printf("Failed to join %s, set COAP_MCAST_IF to choose an interface\n", mcast_groups[i]);
+                continue;
+            }
+            pfd[nfds].fd = mfd;
+            pfd[nfds].events = POLLIN;
+            nfds++;
+        }
+        coap_mcast_setup((uint32_t)time(NULL) ^ (uint32_t)getpid());
+    }
+#endif
 
+    coap_seed_msgid((uint16_t)(time(NULL) ^ getpid()));
     endpoint_setup();
 
+#ifdef LOSSY
+    {
+        lossy_config_t cfg;
+        struct sigaction sa;
+
+        memset(&cfg, 0, sizeof(cfg));
+        if (0 != lossy_parse(&cfg, getenv("COAP_LOSSY")))
+        {
+            printf("Bad COAP_LOSSY\n");
+            return 1;
+        }
+        lossy_setup(&cfg);
+        printf("lossy: loss=%g dup=%g reorder=%g delay=%u jitter=%u rate=%u\n",
+            cfg.loss, cfg.dup, cfg.reorder, cfg.delay_ms, cfg.jitter_ms, cfg.rate_bps);
+        fflush(stdout);
+
+        memset(&sa, 0, sizeof(sa));
+        sa.sa_handler = on_signal;
+        sigaction(SIGINT, &sa, NULL);
+        sigaction(SIGTERM, &sa, NULL);
+    }
+#endif
+
+#if COAP_CONF_INGEST
+    {
+        pthread_t consumer;
+        // -q: stay quiet on NON uploads instead of answering NON 2.04
+        coap_ingest_setup((argc > 1 && 0 == strcmp(argv[1], "-q")) ? COAP_INGEST_REPLY_NONE : COAP_INGEST_REPLY_NON);
+        if (0 != pthread_create(&consumer, NULL, ingest_consumer, NULL))
+            printf("Failed to start ingest consumer\n");
+    }
+#endif
+
     while(1)
     {
         int n, rc;
         socklen_t len = sizeof(cliaddr);
         coap_packet_t pkt;
+        int timeout = -1;
+        nfds_t i;
 
-        n = recvfrom(fd, buf, sizeof(buf), 0, (struct sockaddr *)&cliaddr, &len);
+#ifdef LOSSY
+        if (stop)
+            break;
+#endif
+#if COAP_CONF_RD
+        {
+            struct timespec ts;
+            // registration lifetimes are in seconds
+            clock_gettime(CLOCK_MONOTONIC, &ts);
+            coap_rd_tick((uint32_t)ts.tv_sec);
+            timeout = 1000;
+        }
+#endif
+#if COAP_CONF_MULTICAST
+        {
+            uint32_t now = now_ms();
+            int32_t wait;
+
+            coap_mcast_flush(now, mcast_send, &fd);
+            wait = coap_mcast_timeout(now);
+            if (wait >= 0 && (timeout < 0 || wait < timeout))
+                timeout = wait;
+        }
+#endif
+        if (poll(pfd, nfds, timeout) <= 0)
+            continue;
+        // one datagram per pass, poll() reports the other sockets again
+        for (i=0;i<nfds && !(pfd[i].revents & POLLIN);i++)
+            ;
+        if (i == nfds)
+            continue;
+        n = recvfrom(pfd[i].fd, buf, sizeof(buf), 0, (struct sockaddr *)&cliaddr, &len);
+        if (n < 0)
+            continue;
 #ifdef DEBUG
         printf("Received: ");
         coap_dump(buf, n, true);
@@ -62,7 +389,23 @@ int main(int argc, char **argv)
 #ifdef DEBUG
             coap_dumpPacket(&pkt);
 #endif
-            coap_handle_req(&scratch_buf, &pkt, &rsppkt);
+#ifdef LOSSY
+            handled++;
+            if (lossy_seen(&cliaddr, len, &pkt))
+                duplicates++;
+#endif
+            if (0 != (rc = coap_handle_req(&scratch_buf, &pkt, &rsppkt)))
+            {
+                // the response is incomplete, send nothing rather than garbage
+                if (COAP_ERR_NO_RESPONSE != rc)
+                    printf("coap_handle_req failed rc=%d\n", rc);
+                continue;
+            }
+#if COAP_CONF_MULTICAST
+            // i > 0: the request was sent to a group
+            if (i > 0 && coap_mcast_suppress(&pkt, &rsppkt))
+                continue;
+#endif
 
             if (0 != (rc = coap_build(buf, &rsplen, &rsppkt)))
                 printf("coap_build failed rc=%d\n", rc);
@@ -77,9 +420,22 @@ int main(int argc, char **argv)
                 coap_dumpPacket(&rsppkt);
 #endif
 
+#if COAP_CONF_MULTICAST
+                if (i > 0)
+                {
+                    if (0 != coap_mcast_schedule(now_ms(), buf, rsplen, &cliaddr, len))
+                        printf("Multicast response dropped\n");
+                    continue;
+                }
+#endif
                 sendto(fd, buf, rsplen, 0, (struct sockaddr *)&cliaddr, sizeof(cliaddr));
             }
         }
     }
+
+#ifdef LOSSY
+    lossy_report();
+#endif
+    return 0;
 }
 
@@ -0,0 +1,111 @@
+#include <string.h>
+#include "mcast.h"
+
+#if COAP_CONF_MULTICAST
+
+typedef struct
+{
+    uint32_t due;
+    size_t len;
+    size_t peerlen;
+    uint8_t peer[COAP_MCAST_PEER_MAX];
+    uint8_t data[COAP_MULTICAST_RSPLEN];
+} coap_mcast_pending_t;
+
+static coap_mcast_pending_t pending[COAP_MULTICAST_PENDING];
+// slots in use ordered by due time, then the free ones
+static uint8_t order[COAP_MULTICAST_PENDING];
+static uint8_t npending;
+static uint32_t rng = 1;
+
+// xorshift32
+static uint32_t rnd(void)
+{
+    rng ^= rng << 13;
+    rng ^= rng >> 17;
+    rng ^= rng << 5;
+    return rng;
+}
+
+// a before b, allowing for the clock wrapping
+static bool before(uint32_t a, uint32_t b)
+{
+    return (int32_t)(a - b) < 0;
+}
+
+void coap_mcast_setup(uint32_t seed)
+{
+    uint8_t i;
+    for (i=0;i<COAP_MULTICAST_PENDING;i++)
+        order[i] = i;
+    npending = 0;
+    rng = seed ? seed : 1;
+}
+
+bool coap_mcast_suppress(const coap_packet_t *inpkt, const coap_packet_t *outpkt)
+{
+    // multicast requests must be NON, acknowledging a CON from every
+    // member of the group is exactly the implosion to avoid
+    if (inpkt->hdr.t != COAP_TYPE_NONCON)
+        return true;
+    // 4.xx and 5.xx
+    if ((outpkt->hdr.code >> 5) >= 4)
+        return true;
+    return outpkt->payload.len == 0;
+}
+
+int coap_mcast_schedule(uint32_t now, const uint8_t *data, size_t len, const void *peer, size_t peerlen)
+{
+    coap_mcast_pending_t *p;
+    uint8_t slot, i;
+
+    if (len > COAP_MULTICAST_RSPLEN || peerlen > COAP_MCAST_PEER_MAX || npending == COAP_MULTICAST_PENDING)
+        return COAP_ERR_BUFFER_TOO_SMALL;
+
+    slot = order[npending];
+    p = &pending[slot];
+    p->due = now + rnd() % COAP_MULTICAST_LEISURE_MS;
+    p->len = len;
+    memcpy(p->data, data, len);
+    p->peerlen = peerlen;
+    memcpy(p->peer, peer, peerlen);
+
+    // insertion sort by due time, the queue is short
+    for (i = npending; i > 0 && before(p->due, pending[order[i-1]].due); i--)
+        order[i] = order[i-1];
+    order[i] = slot;
+    npending++;
+    return 0;
+}
+
+int32_t coap_mcast_timeout(uint32_t now)
+{
+    uint32_t due;
+
+    if (npending == 0)
+        return -1;
+    due = pending[order[0]].due;
+    if (!before(now, due))
+        return 0;
+    return (int32_t)(due - now);
+}
+
+size_t coap_mcast_flush(uint32_t now, coap_mcast_send_func fn, void *arg)
+{
+    size_t n = 0;
+
+    while (npending > 0 && !before(now, pending[order[0]].due))
+    {
+        uint8_t slot = order[0];
+        const coap_mcast_pending_t *p = &pending[slot];
+
+        fn(p->data, p->len, p->peer, p->peerlen, arg);
+        npending--;
+        memmove(order, order + 1, npending);
+        order[npending] = slot;
+        n++;
+    }
+    return n;
+}
+
+#endif
@@ -0,0 +1,47 @@
+#ifndef MCAST_H
+#define MCAST_H 1
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "coap.h"
+
+#if COAP_CONF_MULTICAST
+
+// Responses to multicast requests, see
+// http://tools.ietf.org/html/rfc7252#section-8.2
+//
+// When a whole group answers a request at once the responses collide.
+// A server which received a request through a multicast group should
+// therefore stay quiet unless it has something useful to say (no empty or
+// error responses, which coap_mcast_suppress() checks for) and otherwise
+// pick a random point within the leisure period to respond. The built
+// response is queued with coap_mcast_schedule() and coap_mcast_flush()
+// hands it to the transport once it is due. All times are milliseconds
+// from any monotonic origin and may wrap.
+
+#define COAP_MCAST_PEER_MAX 32      // bytes, enough for a struct sockaddr_in6
+
+typedef void (*coap_mcast_send_func)(const uint8_t *data, size_t len, const void *peer, size_t peerlen, void *arg);
+
+void coap_mcast_setup(uint32_t seed);
+// true if outpkt should not be sent in reply to a request that came in
+// through a multicast group
+bool coap_mcast_suppress(const coap_packet_t *inpkt, const coap_packet_t *outpkt);
+// Copies the response and its destination, to be sent a random delay of
+// up to COAP_MULTICAST_LEISURE_MS after now. Returns COAP_ERR_BUFFER_TOO_SMALL
+// if either does not fit or all pending slots are taken.
+int coap_mcast_schedule(uint32_t now, const uint8_t *data, size_t len, const void *peer, size_t peerlen);
+// milliseconds until the next response is due, -1 if none are pending
+int32_t coap_mcast_timeout(uint32_t now);
+// Passes every response due at now to fn, returns how many were sent
+size_t coap_mcast_flush(uint32_t now, coap_mcast_send_func fn, void *arg);
+
+#endif
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
@@ -16,7 +16,7 @@ EthernetClient client;
 EthernetUDP udp;
 uint8_t packetbuf[256];
 static uint8_t scratch_raw[32];
-static coap_rw_buffer_t scratch_buf = {scratch_raw, sizeof(scratch_raw)};
+static coap_arena_t scratch_buf = COAP_ARENA_INIT(scratch_raw);
 
 void setup()
 {
@@ -43,6 +43,9 @@ void setup()
     udp.begin(PORT);
 
     coap_setup();
+    // a floating analog pin is the only entropy at hand
+    randomSeed(analogRead(0));
+    coap_seed_msgid(random(0x10000));
     endpoint_setup();
 }
 
@@ -81,7 +84,16 @@ void loop()
         {
             size_t rsplen = sizeof(packetbuf);
             coap_packet_t rsppkt;
-            coap_handle_req(&scratch_buf, &pkt, &rsppkt);
+            if (0 != (rc = coap_handle_req(&scratch_buf, &pkt, &rsppkt)))
+            {
+                // the response is incomplete, send nothing rather than garbage
+                if (COAP_ERR_NO_RESPONSE != rc)
+                {
+                    Serial.print("coap_handle_req failed rc=");
+                    Serial.println(rc, DEC);
+                }
+                return;
+            }
 
             memset(packetbuf, 0, UDP_TX_PACKET_MAX_SIZE);
             if (0 != (rc = coap_build(packetbuf, &rsplen, &rsppkt)))
@@ -0,0 +1,971 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "rd.h"
+
+#if COAP_CONF_RD
+
+COAP_STATIC_ASSERT(MAXOPT >= 2, rd_needs_two_response_options);
+// rt and if values are located by uint8_t offset and length
+COAP_STATIC_ASSERT(COAP_RD_ATTR_LEN <= 256, rd_attr_len_fits_uint8);
+
+#define NIL 0
+#define BUCKET_MASK (COAP_RD_BUCKETS - 1)
+
+typedef struct
+{
+    char ep[COAP_RD_NAME_LEN];
+    char d[COAP_RD_NAME_LEN];
+    char base[COAP_RD_NAME_LEN];
+    uint32_t lt;
+    uint32_t expires;
+    uint32_t heap_pos;
+    uint32_t links;                 // first link of this registration
+    uint32_t ep_next, ep_prev;      // ep index chain
+    uint32_t d_next, d_prev;        // d index chain
+    uint32_t all_next, all_prev;    // every registration, or the free list
+    bool used;
+} rd_ep_t;
+
+typedef struct
+{
+    char href[COAP_RD_HREF_LEN];
+    char rt[COAP_RD_ATTR_LEN];
+    char iff[COAP_RD_ATTR_LEN];
+    uint32_t ep;                    // owning registration
+    uint32_t next;                  // next link of the registration, or the free list
+    uint32_t vals;                  // first indexed rt/if value of this link
+} rd_link_t;
+
+// rt and if hold space separated values (RFC 6690 section 3.1), each value
+// is indexed on its own so rt=sensor finds rt="temp sensor"
+typedef struct
+{
+    uint32_t link;                  // link carrying this value
+    uint32_t next, prev;            // rt or if index chain
+    uint32_t link_next;             // next value of the same link, or the free list
+    uint8_t off, len;               // position within the link's rt or iff
+    bool rt;                        // rt value, else if
+} rd_val_t;
+
+// slot 0 of both pools is never used so that 0 can mean "none"
+static rd_ep_t eps[COAP_RD_MAX_EPS + 1];
+static rd_link_t links[COAP_RD_MAX_LINKS + 1];
+static rd_val_t vals[COAP_RD_MAX_VALUES + 1];
+static uint32_t ep_free, link_free, val_free, all_head;
+// registrations are reused oldest first, so a stale client's /rd/{id} does
+// not land on whoever registered right after it was removed
+static uint32_t ep_free_tail;
+
+// secondary indexes, each bucket heads a chain through the pool (eps for
+// ep and d, vals for rt and if)
+static uint32_t ep_index[COAP_RD_BUCKETS];
+static uint32_t d_index[COAP_RD_BUCKETS];
+static uint32_t rt_index[COAP_RD_BUCKETS];
+static uint32_t if_index[COAP_RD_BUCKETS];
+
+// 1-based min-heap of registrations ordered by expiry
+static uint32_t heap[COAP_RD_MAX_EPS + 1];
+static uint32_t heap_len;
+static uint32_t rd_now;
+
+#define CHAIN_PUSH(pool, head, i, next, prev) do { \
+        (pool)[i].next = *(head); \
+        (pool)[i].prev = NIL; \
+        if (*(head) != NIL) \
+            (pool)[*(head)].prev = (i); \
+        *(head) = (i); \
+    } while (0)
+
+#define CHAIN_UNLINK(pool, head, i, next, prev) do { \
+        if ((pool)[i].prev != NIL) \
+            (pool)[(pool)[i].prev].next = (pool)[i].next; \
+        else \
+            *(head) = (pool)[i].next; \
+        if ((pool)[i].next != NIL) \
+            (pool)[(pool)[i].next].prev = (pool)[i].prev; \
+    } while (0)
+
+static uint32_t hash_n(const char *s, size_t n)
+{
+    uint32_t h = 2166136261u;   // FNV-1a
+    while (n--)
+        h = (h ^ (uint8_t)*s++) * 16777619u;
+    return h & BUCKET_MASK;
+}
+
+static uint32_t hash(const char *s)
+{
+    return hash_n(s, strlen(s));
+}
+
+static const char *val_str(uint32_t v)
+{
+    return (vals[v].rt ? links[vals[v].link].rt : links[vals[v].link].iff) + vals[v].off;
+}
+
+static uint32_t *val_head(uint32_t v)
+{
+    return vals[v].rt ? &rt_index[hash_n(val_str(v), vals[v].len)] : &if_index[hash_n(val_str(v), vals[v].len)];
+}
+
+static bool live(uint32_t e)
+{
+    return eps[e].used && (int32_t)(eps[e].expires - rd_now) > 0;
+}
+
+static bool heap_less(uint32_t a, uint32_t b)
+{
+    return (int32_t)(eps[heap[a]].expires - eps[heap[b]].expires) < 0;
+}
+
+static void heap_swap(uint32_t a, uint32_t b)
+{
+    uint32_t t = heap[a];
+    heap[a] = heap[b];
+    heap[b] = t;
+    eps[heap[a]].heap_pos = a;
+    eps[heap[b]].heap_pos = b;
+}
+
+static void heap_up(uint32_t i)
+{
+    while (i > 1 && heap_less(i, i / 2))
+    {
+        heap_swap(i, i / 2);
+        i /= 2;
+    }
+}
+
+static void heap_down(uint32_t i)
+{
+    while(1)
+    {
+        uint32_t l = 2 * i, r = l + 1, m = i;
+        if (l <= heap_len && heap_less(l, m))
+            m = l;
+        if (r <= heap_len && heap_less(r, m))
+            m = r;
+        if (m == i)
+            break;
+        heap_swap(i, m);
+        i = m;
+    }
+}
+
+static void heap_insert(uint32_t e)
+{
+    heap[++heap_len] = e;
+    eps[e].heap_pos = heap_len;
+    heap_up(heap_len);
+}
+
+static void heap_remove(uint32_t e)
+{
+    uint32_t i = eps[e].heap_pos, moved;
+    heap_swap(i, heap_len);
+    heap_len--;
+    if (i <= heap_len)
+    {
+        moved = heap[i];
+        heap_up(i);
+        heap_down(eps[moved].heap_pos);
+    }
+}
+
+static void heap_update(uint32_t e)
+{
+    heap_up(eps[e].heap_pos);
+    heap_down(eps[e].heap_pos);
+}
+
+static bool copy_str(char *dst, size_t dstlen, const char *src, size_t srclen)
+{
+    if (srclen >= dstlen)
+        return false;
+    memcpy(dst, src, srclen);
+    dst[srclen] = 0;
+    return true;
+}
+
+void coap_rd_setup(void)
+{
+    uint32_t i;
+
+    memset(eps, 0, sizeof(eps));
+    memset(ep_index, 0, sizeof(ep_index));
+    memset(d_index, 0, sizeof(d_index));
+    memset(rt_index, 0, sizeof(rt_index));
+    memset(if_index, 0, sizeof(if_index));
+
+    for (i=1;i<COAP_RD_MAX_EPS;i++)
+        eps[i].all_next = i + 1;
+    eps[COAP_RD_MAX_EPS].all_next = NIL;
+    ep_free = 1;
+    ep_free_tail = COAP_RD_MAX_EPS;
+
+    for (i=1;i<COAP_RD_MAX_LINKS;i++)
+        links[i].next = i + 1;
+    links[COAP_RD_MAX_LINKS].next = NIL;
+    link_free = 1;
+
+    for (i=1;i<COAP_RD_MAX_VALUES;i++)
+        vals[i].link_next = i + 1;
+    vals[COAP_RD_MAX_VALUES].link_next = NIL;
+    val_free = 1;
+
+    all_head = NIL;
+    heap_len = 0;
+}
+
+// returns a chain of links and their indexed values to the pools
+static void free_chain(uint32_t l)
+{
+    uint32_t next, v, vnext;
+
+    while (l != NIL)
+    {
+        next = links[l].next;
+        for (v = links[l].vals; v != NIL; v = vnext)
+        {
+            vnext = vals[v].link_next;
+            CHAIN_UNLINK(vals, val_head(v), v, next, prev);
+            vals[v].link_next = val_free;
+            val_free = v;
+        }
+        links[l].next = link_free;
+        link_free = l;
+        l = next;
+    }
+}
+
+static void free_links(uint32_t e)
+{
+    free_chain(eps[e].links);
+    eps[e].links = NIL;
+}
+
+static void remove_ep(uint32_t e)
+{
+    free_links(e);
+    CHAIN_UNLINK(eps, &ep_index[hash(eps[e].ep)], e, ep_next, ep_prev);
+    if (eps[e].d[0])
+        CHAIN_UNLINK(eps, &d_index[hash(eps[e].d)], e, d_next, d_prev);
+    CHAIN_UNLINK(eps, &all_head, e, all_next, all_prev);
+    heap_remove(e);
+    eps[e].used = false;
+    eps[e].all_next = NIL;
+    if (ep_free == NIL)
+        ep_free = e;
+    else
+        eps[ep_free_tail].all_next = e;
+    ep_free_tail = e;
+}
+
+static uint32_t find_ep(const char *ep, const char *d)
+{
+    uint32_t e;
+    for (e = ep_index[hash(ep)]; e != NIL; e = eps[e].ep_next)
+        if (0 == strcmp(eps[e].ep, ep) && 0 == strcmp(eps[e].d, d))
+            return e;
+    return NIL;
+}
+
+void coap_rd_tick(uint32_t now)
+{
+    rd_now = now;
+    while (heap_len > 0 && (int32_t)(eps[heap[1]].expires - now) <= 0)
+        remove_ep(heap[1]);
+}
+
+// Indexes every distinct space separated value of the link's rt (or if),
+// false if the value pool ran out
+static bool index_values(uint32_t l, bool rt)
+{
+    const char *s = rt ? links[l].rt : links[l].iff;
+    size_t i = 0, start;
+    uint32_t v;
+
+    while (s[i])
+    {
+        while (s[i] == ' ')
+            i++;
+        start = i;
+        while (s[i] && s[i] != ' ')
+            i++;
+        if (i == start)
+            break;
+        // "a b a" indexes a once
+        for (v = links[l].vals; v != NIL; v = vals[v].link_next)
+            if (vals[v].rt == rt && vals[v].len == i - start && 0 == memcmp(val_str(v), s + start, i - start))
+                break;
+        if (v != NIL)
+            continue;
+
+        if (val_free == NIL)
+            return false;
+        v = val_free;
+        val_free = vals[v].link_next;
+        vals[v].link = l;
+        vals[v].rt = rt;
+        vals[v].off = (uint8_t)start;
+        vals[v].len = (uint8_t)(i - start);
+        vals[v].link_next = links[l].vals;
+        links[l].vals = v;
+        CHAIN_PUSH(vals, val_head(v), v, next, prev);
+    }
+    return true;
+}
+
+// http://tools.ietf.org/html/rfc6690#section-2
+// <href>;attr=value;attr="value",<href>...  only rt and if are kept
+// Builds the links of e into a new chain at *head, indexed as they go. On
+// failure *head holds whatever was built so far for free_chain().
+static coap_rd_result_t parse_links(uint32_t e, const uint8_t *p, size_t len, uint32_t *head)
+{
+    size_t i = 0, start;
+    uint32_t tail = NIL;
+
+    *head = NIL;
+
+    while (i < len)
+    {
+        uint32_t l;
+
+        while (i < len && (p[i] == ' ' || p[i] == '\r' || p[i] == '\n'))
+            i++;
+        if (i == len)
+            break;
+        if (p[i] != '<')
+            return COAP_RD_BAD_REQUEST;
+        start = ++i;
+        while (i < len && p[i] != '>')
+            i++;
+        if (i == len)
+            return COAP_RD_BAD_REQUEST;
+
+        if (link_free == NIL)
+            return COAP_RD_FULL;
+        l = link_free;
+        link_free = links[l].next;
+        memset(&links[l], 0, sizeof(links[l]));
+        links[l].ep = e;
+        // append, so lookups return links in registration order
+        if (tail == NIL)
+            *head = l;
+        else
+            links[tail].next = l;
+        tail = l;
+
+        if (!copy_str(links[l].href, sizeof(links[l].href), (const char *)p + start, i - start))
+            return COAP_RD_BAD_REQUEST;
+        i++;
+
+        while (i < len && p[i] == ';')
+        {
+            size_t name = ++i, namelen, val, vallen = 0;
+
+            while (i < len && p[i] != '=' && p[i] != ';' && p[i] != ',')
+                i++;
+            namelen = i - name;
+            val = i;
+            if (i < len && p[i] == '=')
+            {
+                i++;
+                if (i < len && p[i] == '"')
+                {
+                    val = ++i;
+                    while (i < len && p[i] != '"')
+                        i++;
+                    if (i == len)
+                        return COAP_RD_BAD_REQUEST;
+                    vallen = i - val;
+                    i++;
+                }
+                else
+                {
+                    val = i;
+                    while (i < len && p[i] != ';' && p[i] != ',')
+                        i++;
+                    vallen = i - val;
+                }
+            }
+
+            if (namelen == 2 && 0 == memcmp(p + name, "rt", 2))
+            {
+                if (!copy_str(links[l].rt, sizeof(links[l].rt), (const char *)p + val, vallen))
+                    return COAP_RD_BAD_REQUEST;
+            }
+            else
+            if (namelen == 2 && 0 == memcmp(p + name, "if", 2))
+            {
+                if (!copy_str(links[l].iff, sizeof(links[l].iff), (const char *)p + val, vallen))
+                    return COAP_RD_BAD_REQUEST;
+            }
+        }
+
+        if (!index_values(l, true) || !index_values(l, false))
+            return COAP_RD_FULL;
+
+        if (i < len)
+        {
+            if (p[i] != ',')
+                return COAP_RD_BAD_REQUEST;
+            i++;
+        }
+    }
+    return COAP_RD_OK;
+}
+
+coap_rd_result_t coap_rd_register(const char *ep, const char *d, const char *base, uint32_t lt, const uint8_t *data, size_t datalen, uint32_t *id)
+{
+    coap_rd_result_t rc;
+    uint32_t e, fresh;
+    bool created = false;
+
+    if (NULL == d)
+        d = "";
+    if (NULL == base)
+        base = "";
+    if (NULL == ep || 0 == ep[0] || strlen(ep) >= COAP_RD_NAME_LEN || strlen(d) >= COAP_RD_NAME_LEN || strlen(base) >= COAP_RD_NAME_LEN)
+        return COAP_RD_BAD_REQUEST;
+    if (lt > COAP_RD_MAX_LT)
+        return COAP_RD_BAD_REQUEST;
+    if (0 == lt)
+        lt = COAP_RD_DEFAULT_LT;
+
+    if (NIL == (e = find_ep(ep, d)))
+    {
+        if (ep_free == NIL)
+            return COAP_RD_FULL;
+        e = ep_free;
+        ep_free = eps[e].all_next;
+        memset(&eps[e], 0, sizeof(eps[e]));
+        strcpy(eps[e].ep, ep);
+        strcpy(eps[e].d, d);
+        eps[e].used = true;
+        eps[e].lt = lt;
+        eps[e].expires = rd_now + lt;
+        CHAIN_PUSH(eps, &ep_index[hash(ep)], e, ep_next, ep_prev);
+        if (d[0])
+            CHAIN_PUSH(eps, &d_index[hash(d)], e, d_next, d_prev);
+        CHAIN_PUSH(eps, &all_head, e, all_next, all_prev);
+        heap_insert(e);
+        created = true;
+    }
+
+    // a failed re-registration leaves the existing one untouched
+    if (COAP_RD_OK != (rc = parse_links(e, data, datalen, &fresh)))
+    {
+        free_chain(fresh);
+        if (created)
+            remove_ep(e);
+        return rc;
+    }
+
+    // re-registration replaces the links and keeps the location
+    free_links(e);
+    eps[e].links = fresh;
+    eps[e].lt = lt;
+    eps[e].expires = rd_now + lt;
+    heap_update(e);
+    strcpy(eps[e].base, base);
+    *id = e;
+    return COAP_RD_OK;
+}
+
+coap_rd_result_t coap_rd_update(uint32_t id, const char *base, uint32_t lt)
+{
+    if (id == NIL || id > COAP_RD_MAX_EPS || !live(id))
+        return COAP_RD_NOT_FOUND;
+    if ((base && strlen(base) >= COAP_RD_NAME_LEN) || lt > COAP_RD_MAX_LT)
+        return COAP_RD_BAD_REQUEST;
+    if (base && base[0])
+        strcpy(eps[id].base, base);
+    if (lt > 0)
+        eps[id].lt = lt;
+    eps[id].expires = rd_now + eps[id].lt;
+    heap_update(id);
+    return COAP_RD_OK;
+}
+
+coap_rd_result_t coap_rd_remove(uint32_t id)
+{
+    if (id == NIL || id > COAP_RD_MAX_EPS || !live(id))
+        return COAP_RD_NOT_FOUND;
+    remove_ep(id);
+    return COAP_RD_OK;
+}
+
+/////////////////////////////////////////
+// lookup
+
+// link-format writer that skips the first 'skip' bytes, for Block2
+typedef struct
+{
+    char *buf;
+    size_t cap;
+    size_t len;
+    size_t skip;
+    bool more;
+    uint32_t matched;           // results matched so far, for paging
+    uint32_t first;             // first result of the page
+    uint32_t last;              // one past the last result of the page, 0 for none
+    uint32_t written;           // results written into the stream
+} rd_out_t;
+
+static void out_mem(rd_out_t *o, const char *s, size_t n)
+{
+    if (o->more)
+        return;
+    if (o->skip >= n)
+    {
+        o->skip -= n;
+        return;
+    }
+    s += o->skip;
+    n -= o->skip;
+    o->skip = 0;
+    if (n > o->cap - o->len)
+    {
+        memcpy(o->buf + o->len, s, o->cap - o->len);
+        o->len = o->cap;
+        o->more = true;
+        return;
+    }
+    memcpy(o->buf + o->len, s, n);
+    o->len += n;
+}
+
+static void out_str(rd_out_t *o, const char *s)
+{
+    out_mem(o, s, strlen(s));
+}
+
+static void out_attr(rd_out_t *o, const char *name, const char *val)
+{
+    out_str(o, ";");
+    out_str(o, name);
+    out_str(o, "=\"");
+    out_str(o, val);
+    out_str(o, "\"");
+}
+
+// true if this result belongs to the page and should be written
+static bool out_begin(rd_out_t *o)
+{
+    uint32_t m = o->matched++;
+    if (m < o->first || (o->last && m >= o->last))
+        return false;
+    if (o->written++ > 0)
+        out_str(o, ",");
+    return true;
+}
+
+// stop walking once the block is full or the page is complete
+static bool out_done(const rd_out_t *o)
+{
+    return o->more || (o->last && o->matched >= o->last);
+}
+
+static void out_init(rd_out_t *o, const coap_rd_query_t *q, char *buf, size_t buflen, size_t offset)
+{
+    memset(o, 0, sizeof(*o));
+    o->buf = buf;
+    o->cap = buflen;
+    o->skip = offset;
+    if (q->count > 0)
+    {
+        o->first = q->page * q->count;
+        o->last = o->first + q->count;
+    }
+}
+
+static bool match(const char *want, const char *have)
+{
+    size_t n;
+
+    if (NULL == want)
+        return true;
+    n = strlen(want);
+    if (n > 0 && want[n-1] == '*')
+        return 0 == strncmp(want, have, n - 1);
+    return 0 == strcmp(want, have);
+}
+
+// want against each space separated value in have
+static bool match_values(const char *want, const char *have)
+{
+    size_t n, start, i = 0;
+    bool prefix;
+
+    if (NULL == want)
+        return true;
+    n = strlen(want);
+    prefix = n > 0 && want[n-1] == '*';
+    if (prefix)
+        n--;
+    while (have[i])
+    {
+        while (have[i] == ' ')
+            i++;
+        start = i;
+        while (have[i] && have[i] != ' ')
+            i++;
+        if (i == start)
+            break;
+        if ((prefix ? i - start >= n : i - start == n) && 0 == memcmp(have + start, want, n))
+            return true;
+    }
+    return false;
+}
+
+// the index entry v holds exactly want
+static bool val_is(uint32_t v, const char *want)
+{
+    return vals[v].len == strlen(want) && 0 == memcmp(val_str(v), want, vals[v].len);
+}
+
+static bool indexable(const char *want)
+{
+    return NULL != want && 0 != want[0] && '*' != want[strlen(want) - 1];
+}
+
+static bool match_ep(const coap_rd_query_t *q, uint32_t e)
+{
+    return live(e) && match(q->ep, eps[e].ep) && match(q->d, eps[e].d);
+}
+
+static bool match_link(const coap_rd_query_t *q, uint32_t l)
+{
+    return match_ep(q, links[l].ep) && match_values(q->rt, links[l].rt) && match_values(q->iff, links[l].iff) && match(q->href, links[l].href);
+}
+
+static void emit_ep(rd_out_t *o, uint32_t e)
+{
+    char tmp[32];
+
+    if (!out_begin(o))
+        return;
+    snprintf(tmp, sizeof(tmp), "</rd/%lu>", (unsigned long)e);
+    out_str(o, tmp);
+    out_attr(o, "ep", eps[e].ep);
+    if (eps[e].d[0])
+        out_attr(o, "d", eps[e].d);
+    if (eps[e].base[0])
+        out_attr(o, "base", eps[e].base);
+    snprintf(tmp, sizeof(tmp), ";lt=%lu", (unsigned long)eps[e].lt);
+    out_str(o, tmp);
+}
+
+static void emit_link(rd_out_t *o, uint32_t l)
+{
+    const rd_ep_t *ep = &eps[links[l].ep];
+    const char *href = links[l].href;
+
+    if (!out_begin(o))
+        return;
+    out_str(o, "<");
+    // resolve relative references against the registration base
+    if (ep->base[0] && NULL == strstr(href, "://"))
+    {
+        size_t n = strlen(ep->base);
+        out_mem(o, ep->base, (n > 0 && ep->base[n-1] == '/' && href[0] == '/') ? n - 1 : n);
+    }
+    out_str(o, href);
+    out_str(o, ">");
+    if (links[l].rt[0])
+        out_attr(o, "rt", links[l].rt);
+    if (links[l].iff[0])
+        out_attr(o, "if", links[l].iff);
+    if (ep->base[0])
+        out_attr(o, "anchor", ep->base);
+    else
+        out_attr(o, "ep", ep->ep);
+}
+
+uint32_t coap_rd_lookup_ep(const coap_rd_query_t *q, char *buf, size_t buflen, size_t offset, size_t *len, bool *more)
+{
+    rd_out_t o;
+    uint32_t e;
+
+    out_init(&o, q, buf, buflen, offset);
+
+    if (indexable(q->ep))
+    {
+        for (e = ep_index[hash(q->ep)]; e != NIL && !out_done(&o); e = eps[e].ep_next)
+            if (match_ep(q, e))
+                emit_ep(&o, e);
+    }
+    else
+    if (indexable(q->d))
+    {
+        for (e = d_index[hash(q->d)]; e != NIL && !out_done(&o); e = eps[e].d_next)
+            if (match_ep(q, e))
+                emit_ep(&o, e);
+    }
+    else
+    {
+        for (e = all_head; e != NIL && !out_done(&o); e = eps[e].all_next)
+            if (match_ep(q, e))
+                emit_ep(&o, e);
+    }
+
+    *len = o.len;
+    *more = o.more;
+    return o.written;
+}
+
+uint32_t coap_rd_lookup_res(const coap_rd_query_t *q, char *buf, size_t buflen, size_t offset, size_t *len, bool *more)
+{
+    rd_out_t o;
+    uint32_t e, l, v;
+
+    out_init(&o, q, buf, buflen, offset);
+
+    // drive the walk from the most selective index available
+    if (indexable(q->rt))
+    {
+        for (v = rt_index[hash(q->rt)]; v != NIL && !out_done(&o); v = vals[v].next)
+            if (vals[v].rt && val_is(v, q->rt) && match_link(q, vals[v].link))
+                emit_link(&o, vals[v].link);
+    }
+    else
+    if (indexable(q->iff))
+    {
+        for (v = if_index[hash(q->iff)]; v != NIL && !out_done(&o); v = vals[v].next)
+            if (!vals[v].rt && val_is(v, q->iff) && match_link(q, vals[v].link))
+                emit_link(&o, vals[v].link);
+    }
+    else
+    {
+        const uint32_t *chain = &all_head;
+        bool by_ep = indexable(q->ep), by_d = !by_ep && indexable(q->d);
+
+        if (by_ep)
+            chain = &ep_index[hash(q->ep)];
+        else
+        if (by_d)
+            chain = &d_index[hash(q->d)];
+
+        for (e = *chain; e != NIL && !out_done(&o); e = by_ep ? eps[e].ep_next : by_d ? eps[e].d_next : eps[e].all_next)
+        {
+            if (!match_ep(q, e))
+                continue;
+            for (l = eps[e].links; l != NIL && !out_done(&o); l = links[l].next)
+                if (match_link(q, l))
+                    emit_link(&o, l);
+        }
+    }
+
+    *len = o.len;
+    *more = o.more;
+    return o.written;
+}
+
+/////////////////////////////////////////
+// CoAP interface
+
+// 1 if found, 0 if absent (val is ""), -1 if the value does not fit
+static int query_get(const coap_packet_t *pkt, const char *key, char *val, size_t vallen)
+{
+    const coap_option_t *opt;
+    uint8_t count, i;
+    size_t keylen = strlen(key);
+
+    val[0] = 0;
+    if (NULL == (opt = coap_findOptions(pkt, COAP_OPTION_URI_QUERY, &count)))
+        return 0;
+    for (i=0;i<count;i++)
+    {
+        if (opt[i].buf.len > keylen && 0 == memcmp(opt[i].buf.p, key, keylen) && opt[i].buf.p[keylen] == '=')
+        {
+            if (!copy_str(val, vallen, (const char *)opt[i].buf.p + keylen + 1, opt[i].buf.len - keylen - 1))
+                return -1;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+static int query_uint(const coap_packet_t *pkt, const char *key, uint32_t *v)
+{
+    char tmp[11];
+    char *end;
+    unsigned long n;
+    int rc;
+
+    if (1 != (rc = query_get(pkt, key, tmp, sizeof(tmp))))
+        return rc;
+    n = strtoul(tmp, &end, 10);
+    if (*end != 0 || tmp[0] == 0 || n > 0xFFFFFFFFUL)
+        return -1;
+    *v = (uint32_t)n;
+    return 1;
+}
+
+// the {id} in /rd/{id}
+static bool path_id(const coap_packet_t *pkt, uint32_t *id)
+{
+    const coap_option_t *opt;
+    uint8_t count;
+    uint32_t n = 0;
+    size_t i;
+
+    if (NULL == (opt = coap_findOptions(pkt, COAP_OPTION_URI_PATH, &count)) || count != 2)
+        return false;
+    if (opt[1].buf.len == 0 || opt[1].buf.len > 10)
+        return false;
+    for (i=0;i<opt[1].buf.len;i++)
+    {
+        if (opt[1].buf.p[i] < '0' || opt[1].buf.p[i] > '9')
+            return false;
+        n = n * 10 + (opt[1].buf.p[i] - '0');
+    }
+    *id = n;
+    return true;
+}
+
+static int rd_error(coap_arena_t *scratch, const coap_packet_t *inpkt, coap_packet_t *outpkt, uint8_t id_hi, uint8_t id_lo, coap_rd_result_t rc)
+{
+    coap_responsecode_t rspcode = COAP_RSPCODE_BAD_REQUEST;
+
+    if (rc == COAP_RD_NOT_FOUND)
+        rspcode = COAP_RSPCODE_NOT_FOUND;
+    else
+    if (rc == COAP_RD_FULL)
+        rspcode = COAP_RSPCODE_SERVICE_UNAVAILABLE;
+    return coap_make_response(scratch, outpkt, NULL, 0, id_hi, id_lo, &inpkt->tok, rspcode, COAP_CONTENTTYPE_NONE);
+}
+
+int coap_rd_handle_register(coap_arena_t *scratch, const coap_packet_t *inpkt, coap_packet_t *outpkt, uint8_t id_hi, uint8_t id_lo)
+{
+    char ep[COAP_RD_NAME_LEN], d[COAP_RD_NAME_LEN], base[COAP_RD_NAME_LEN];
+    uint32_t lt = 0, id;
+    coap_rd_result_t rc;
+    char *loc;
+    size_t len;
+    int err;
+
+    if (1 != query_get(inpkt, "ep", ep, sizeof(ep)) || query_get(inpkt, "d", d, sizeof(d)) < 0 ||
+        query_get(inpkt, "base", base, sizeof(base)) < 0 || query_uint(inpkt, "lt", &lt) < 0)
+        return rd_error(scratch, inpkt, outpkt, id_hi, id_lo, COAP_RD_BAD_REQUEST);
+
+    if (COAP_RD_OK != (rc = coap_rd_register(ep, d, base, lt, inpkt->payload.p, inpkt->payload.len, &id)))
+        return rd_error(scratch, inpkt, outpkt, id_hi, id_lo, rc);
+
+    if (0 != (err = coap_make_response(scratch, outpkt, NULL, 0, id_hi, id_lo, &inpkt->tok, COAP_RSPCODE_CREATED, COAP_CONTENTTYPE_NONE)))
+        return err;
+    // Location-Path: rd/{id}
+    if (NULL == (loc = coap_arena_printf(scratch, &len, "%lu", (unsigned long)id)))
+        return COAP_ERR_BUFFER_TOO_SMALL;
+    if (0 != (err = coap_add_option(outpkt, COAP_OPTION_LOCATION_PATH, (const uint8_t *)"rd", 2)))
+        return err;
+    return coap_add_option(outpkt, COAP_OPTION_LOCATION_PATH, (const uint8_t *)loc, len);
+}
+
+int coap_rd_handle_update(coap_arena_t *scratch, const coap_packet_t *inpkt, coap_packet_t *outpkt, uint8_t id_hi, uint8_t id_lo)
+{
+    char base[COAP_RD_NAME_LEN];
+    uint32_t lt = 0, id;
+    coap_rd_result_t rc;
+
+    if (!path_id(inpkt, &id))
+        return rd_error(scratch, inpkt, outpkt, id_hi, id_lo, COAP_RD_NOT_FOUND);
+    if (query_get(inpkt, "base", base, sizeof(base)) < 0 || query_uint(inpkt, "lt", &lt) < 0)
+        return rd_error(scratch, inpkt, outpkt, id_hi, id_lo, COAP_RD_BAD_REQUEST);
+    if (COAP_RD_OK != (rc = coap_rd_update(id, base, lt)))
+        return rd_error(scratch, inpkt, outpkt, id_hi, id_lo, rc);
+    return coap_make_response(scratch, outpkt, NULL, 0, id_hi, id_lo, &inpkt->tok, COAP_RSPCODE_CHANGED, COAP_CONTENTTYPE_NONE);
+}
+
+int coap_rd_handle_remove(coap_arena_t *scratch, const coap_packet_t *inpkt, coap_packet_t *outpkt, uint8_t id_hi, uint8_t id_lo)
+{
+    uint32_t id;
+    coap_rd_result_t rc;
+
+    if (!path_id(inpkt, &id))
+        return rd_error(scratch, inpkt, outpkt, id_hi, id_lo, COAP_RD_NOT_FOUND);
+    if (COAP_RD_OK != (rc = coap_rd_remove(id)))
+        return rd_error(scratch, inpkt, outpkt, id_hi, id_lo, rc);
+    return coap_make_response(scratch, outpkt, NULL, 0, id_hi, id_lo, &inpkt->tok, COAP_RSPCODE_DELETED, COAP_CONTENTTYPE_NONE);
+}
+
+static int rd_lookup(coap_arena_t *scratch, const coap_packet_t *inpkt, coap_packet_t *outpkt, uint8_t id_hi, uint8_t id_lo, bool res)
+{
+    char ep[COAP_RD_NAME_LEN], d[COAP_RD_NAME_LEN], rt[COAP_RD_ATTR_LEN], iff[COAP_RD_ATTR_LEN], href[COAP_RD_HREF_LEN];
+    coap_rd_query_t q;
+    const coap_option_t *opt;
+    uint8_t count, szx = 0;
+    uint32_t num = 0, v = 0;
+    size_t len, size, offset, avail, i;
+    char *rsp;
+    bool more;
+    int rc;
+
+    while ((16U << szx) < COAP_RD_BLOCK_SIZE)
+        szx++;
+
+    memset(&q, 0, sizeof(q));
+    if (query_get(inpkt, "ep", ep, sizeof(ep)) < 0 || query_get(inpkt, "d", d, sizeof(d)) < 0 ||
+        query_get(inpkt, "rt", rt, sizeof(rt)) < 0 || query_get(inpkt, "if", iff, sizeof(iff)) < 0 ||
+        query_get(inpkt, "href", href, sizeof(href)) < 0 ||
+        query_uint(inpkt, "page", &q.page) < 0 || query_uint(inpkt, "count", &q.count) < 0)
+        return rd_error(scratch, inpkt, outpkt, id_hi, id_lo, COAP_RD_BAD_REQUEST);
+    q.ep = ep[0] ? ep : NULL;
+    q.d = d[0] ? d : NULL;
+    q.rt = rt[0] ? rt : NULL;
+    q.iff = iff[0] ? iff : NULL;
+    q.href = href[0] ? href : NULL;
+
+    // http://tools.ietf.org/html/rfc7959#section-2.2, the client may ask
+    // for smaller blocks than ours but not for larger ones
+    if (NULL != (opt = coap_findOptions(inpkt, COAP_OPTION_BLOCK2, &count)))
+    {
+        if (opt->buf.len > 3)
+            return rd_error(scratch, inpkt, outpkt, id_hi, id_lo, COAP_RD_BAD_REQUEST);
+        for (i=0;i<opt->buf.len;i++)
+            v = (v << 8) | opt->buf.p[i];
+        if ((v & 0x07) == 7)
+            return rd_error(scratch, inpkt, outpkt, id_hi, id_lo, COAP_RD_BAD_REQUEST);
+        num = v >> 4;
+        if ((v & 0x07) < szx)
+            szx = v & 0x07;
+    }
+    offset = (size_t)num * (16U << szx);
+
+    // The block comes out of scratch. If it is short, fall back to smaller
+    // blocks, leaving room for the Content-Format and Block2 values.
+    avail = scratch->size - scratch->used;
+    avail = (avail > 8) ? avail - 8 : 0;
+    while (szx > 0 && (16U << szx) > avail)
+        szx--;
+    size = 16U << szx;
+    num = offset / size;
+    if (NULL == (rsp = coap_arena_alloc(scratch, size, 1)))
+        return rd_error(scratch, inpkt, outpkt, id_hi, id_lo, COAP_RD_FULL);
+
+    if (res)
+        coap_rd_lookup_res(&q, rsp, size, offset, &len, &more);
+    else
+        coap_rd_lookup_ep(&q, rsp, size, offset, &len, &more);
+
+    if (0 != (rc = coap_make_response(scratch, outpkt, (const uint8_t *)rsp, len, id_hi, id_lo, &inpkt->tok, COAP_RSPCODE_CONTENT, COAP_CONTENTTYPE_APPLICATION_LINKFORMAT)))
+        return rc;
+
+    if (more || opt != NULL)
+        return coap_add_option_uint(scratch, outpkt, COAP_OPTION_BLOCK2, (num << 4) | (more ? 0x08 : 0) | szx);
+    return 0;
+}
+
+int coap_rd_handle_lookup_ep(coap_arena_t *scratch, const coap_packet_t *inpkt, coap_packet_t *outpkt, uint8_t id_hi, uint8_t id_lo)
+{
+    return rd_lookup(scratch, inpkt, outpkt, id_hi, id_lo, false);
+}
+
+int coap_rd_handle_lookup_res(coap_arena_t *scratch, const coap_packet_t *inpkt, coap_packet_t *outpkt, uint8_t id_hi, uint8_t id_lo)
+{
+    return rd_lookup(scratch, inpkt, outpkt, id_hi, id_lo, true);
+}
+
+#endif
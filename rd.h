@@ -0,0 +1,77 @@
+#ifndef RD_H
+#define RD_H 1
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+#include "coap.h"
+
+#if COAP_CONF_RD
+
+// Resource Directory, see https://tools.ietf.org/html/rfc9176
+//
+//   POST   /rd?ep=name[&d=domain][&lt=secs][&base=uri]   register (link-format payload)
+//   POST   /rd/{id}[?lt=secs][&base=uri]                 update, refreshes the lifetime
+//   DELETE /rd/{id}                                      remove
+//   GET    /rd-lookup/ep?[ep=][&d=][&page=&count=]       endpoint lookup
+//   GET    /rd-lookup/res?[ep=][&d=][&rt=][&if=][&href=][&page=&count=]
+//
+// Registrations and links live in fixed pools sized in coap_config.h.
+// Hash indexes on ep, d, rt and if keep lookups proportional to the number
+// of matches rather than the size of the directory. rt and if filters
+// match any one of a link's space separated values. A value ending in '*'
+// matches as a prefix but then cannot use its index. Lookup results are
+// paged with page/count and served block-wise (Block2) when they do not
+// fit one block. Lifetimes expire through a min-heap driven by
+// coap_rd_tick().
+
+#define COAP_RD_DEFAULT_LT 90000    // seconds, RFC 9176 section 5
+#define COAP_RD_MAX_LT 0x7FFFFFFFUL // expiry times compare as signed 32-bit differences
+
+typedef enum
+{
+    COAP_RD_OK = 0,
+    COAP_RD_BAD_REQUEST = 1,        // missing ep, value too long, bad link-format, lt over COAP_RD_MAX_LT
+    COAP_RD_NOT_FOUND = 2,          // no such registration
+    COAP_RD_FULL = 3                // out of registration or link slots
+} coap_rd_result_t;
+
+typedef struct
+{
+    const char *ep;                 /* filters, NULL matches anything */
+    const char *d;
+    const char *rt;                 /* resource lookup only */
+    const char *iff;                /* "if", resource lookup only */
+    const char *href;               /* resource lookup only */
+    uint32_t page;                  /* skip page * count results */
+    uint32_t count;                 /* results per page, 0 for all */
+} coap_rd_query_t;
+
+void coap_rd_setup(void);
+// advance the directory clock (seconds, any monotonic origin) and expire registrations
+void coap_rd_tick(uint32_t now);
+
+coap_rd_result_t coap_rd_register(const char *ep, const char *d, const char *base, uint32_t lt, const uint8_t *links, size_t linklen, uint32_t *id);
+coap_rd_result_t coap_rd_update(uint32_t id, const char *base, uint32_t lt);
+coap_rd_result_t coap_rd_remove(uint32_t id);
+
+// Write the link-format result starting at byte offset into buf. *len gets
+// the bytes written, *more whether output continues past buf. Returns the
+// number of results produced so far.
+uint32_t coap_rd_lookup_ep(const coap_rd_query_t *q, char *buf, size_t buflen, size_t offset, size_t *len, bool *more);
+uint32_t coap_rd_lookup_res(const coap_rd_query_t *q, char *buf, size_t buflen, size_t offset, size_t *len, bool *more);
+
+int coap_rd_handle_register(coap_arena_t *scratch, const coap_packet_t *inpkt, coap_packet_t *outpkt, uint8_t id_hi, uint8_t id_lo);
+int coap_rd_handle_update(coap_arena_t *scratch, const coap_packet_t *inpkt, coap_packet_t *outpkt, uint8_t id_hi, uint8_t id_lo);
+int coap_rd_handle_remove(coap_arena_t *scratch, const coap_packet_t *inpkt, coap_packet_t *outpkt, uint8_t id_hi, uint8_t id_lo);
+int coap_rd_handle_lookup_ep(coap_arena_t *scratch, const coap_packet_t *inpkt, coap_packet_t *outpkt, uint8_t id_hi, uint8_t id_lo);
+int coap_rd_handle_lookup_res(coap_arena_t *scratch, const coap_packet_t *inpkt, coap_packet_t *outpkt, uint8_t id_hi, uint8_t id_lo);
+
+#endif
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif
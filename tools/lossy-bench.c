@@ -0,0 +1,280 @@
+// CoAP load generator for the lossy shim scenarios.
+//
+// Sends -n requests with up to -w outstanding, retransmits CON requests with
+// RFC 7252 exponential back-off and reports goodput, retransmissions,
+// duplicate responses and latency percentiles. Talks plain UDP, the
+// impairment is applied by the server (see lossy.h).
+
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+#include <poll.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#define ACK_RANDOM_FACTOR 1.5
+
+typedef struct
+{
+    uint16_t msgid;
+    uint64_t first_sent;
+    uint64_t deadline;
+    uint64_t timeout;
+    int retries;
+    bool inflight;
+    bool done;
+} request_t;
+
+static uint64_t now_us(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static int cmp_double(const void *a, const void *b)
+{
+    double x = *(const double *)a, y = *(const double *)b;
+    return (x > y) - (x < y);
+}
+
+// header, 4 byte token carrying the request index, Uri-Path and payload
+static size_t encode(uint8_t *buf, uint8_t type, uint8_t code, uint16_t msgid, uint32_t idx, const char *path, const char *payload)
+{
+    uint8_t *p = buf;
+    uint8_t prev = 0;
+    const char *seg = path;
+
+    *p++ = 0x40 | (type << 4) | 4;
+    *p++ = code;
+    *p++ = msgid >> 8;
+    *p++ = msgid & 0xFF;
+    *p++ = idx >> 24;
+    *p++ = idx >> 16;
+    *p++ = idx >> 8;
+    *p++ = idx;
+
+    while (*seg)
+    {
+        const char *end = strchr(seg, '/');
+        size_t len = end ? (size_t)(end - seg) : strlen(seg);
+        if (len > 0 && len < 13)
+        {
+            *p++ = ((11 - prev) << 4) | len;
+            memcpy(p, seg, len);
+            p += len;
+            prev = 11;
+        }
+        seg += len;
+        if (*seg == '/')
+            seg++;
+    }
+
+    if (payload && *payload)
+    {
+        *p++ = 0xFF;
+        memcpy(p, payload, strlen(payload));
+        p += strlen(payload);
+    }
+    return p - buf;
+}
+
+static void usage(const char *argv0)
+{
+    fprintf(stderr, "usage: %s [-h host] [-p port] [-n requests] [-w window] [-t ack_timeout_ms]\n"
+                    "          [-r max_retransmit] [-m get|put|post] [-u path] [-e payload] [-N]\n", argv0);
+}
+
+int main(int argc, char **argv)
+{
+    const char *host = "127.0.0.1", *path = "light", *payload = NULL;
+    int port = 5683, count = 200, window = 8, ack_timeout_ms = 200, max_retransmit = 4;
+    uint8_t code = 1, type = 0;     // GET, CON
+    request_t *reqs;
+    double *lat;
+    struct sockaddr_in srv;
+    int fd, opt, next = 0, inflight = 0, finished = 0, i;
+    unsigned long ok = 0, failed = 0, retransmits = 0, dup_rsp = 0, rsp_bytes = 0;
+    uint16_t msgid = (uint16_t)getpid();
+    uint64_t start, elapsed;
+    uint8_t buf[2048];
+
+    while ((opt = getopt(argc, argv, "h:p:n:w:t:r:m:u:e:N")) != -1)
+    {
+        switch (opt)
+        {
+            case 'h': host = optarg; break;
+            case 'p': port = atoi(optarg); break;
+            case 'n': count = atoi(optarg); break;
+            case 'w': window = atoi(optarg); break;
+            case 't': ack_timeout_ms = atoi(optarg); break;
+            case 'r': max_retransmit = atoi(optarg); break;
+            case 'm':
+                code = (0 == strcmp(optarg, "put")) ? 3 : (0 == strcmp(optarg, "post")) ? 2 : 1;
+                break;
+            case 'u': path = optarg; break;
+            case 'e': payload = optarg; break;
+            case 'N': type = 1; break;
+            default: usage(argv[0]); return 1;
+        }
+    }
+    if (count <= 0 || window <= 0)
+    {
+        usage(argv[0]);
+        return 1;
+    }
+
+    reqs = calloc(count, sizeof(*reqs));
+    lat = calloc(count, sizeof(*lat));
+    if (NULL == reqs || NULL == lat)
+        return 1;
+
+    memset(&srv, 0, sizeof(srv));
+    srv.sin_family = AF_INET;
+    srv.sin_port = htons(port);
+    if (1 != inet_pton(AF_INET, host, &srv.sin_addr))
+    {
+        fprintf(stderr, "bad host %s\n", host);
+        return 1;
+    }
+    fd = socket(AF_INET, SOCK_DGRAM, 0);
+    srand(getpid());
+
+    start = now_us();
+    while (finished < count)
+    {
+        uint64_t now = now_us(), wake = UINT64_MAX;
+        struct pollfd pfd;
+        int wait_ms;
+
+        // open the window
+        while (inflight < window && next < count)
+        {
+            request_t *r = &reqs[next];
+            size_t len;
+
+            r->msgid = msgid++;
+            r->first_sent = now;
+            r->timeout = (uint64_t)ack_timeout_ms * 1000 * (1.0 + (ACK_RANDOM_FACTOR - 1.0) * rand() / RAND_MAX);
+            r->deadline = now + r->timeout;
+            r->inflight = true;
+            len = encode(buf, type, code, r->msgid, next, path, payload);
+            sendto(fd, buf, len, 0, (struct sockaddr *)&srv, sizeof(srv));
+            inflight++;
+            next++;
+        }
+
+        // retransmit or give up
+        for (i=0;i<next;i++)
+        {
+            request_t *r = &reqs[i];
+            if (!r->inflight)
+                continue;
+            if (r->deadline <= now)
+            {
+                if (type == 0 && r->retries < max_retransmit)
+                {
+                    size_t len = encode(buf, type, code, r->msgid, i, path, payload);
+                    sendto(fd, buf, len, 0, (struct sockaddr *)&srv, sizeof(srv));
+                    r->retries++;
+                    r->timeout *= 2;
+                    r->deadline = now + r->timeout;
+                    retransmits++;
+                }
+                else
+                {
+                    r->inflight = false;
+                    inflight--;
+                    finished++;
+                    failed++;
+                    continue;
+                }
+            }
+            if (r->deadline < wake)
+                wake = r->deadline;
+        }
+        if (finished >= count)
+            break;
+
+        wait_ms = (wake == UINT64_MAX) ? 1000 : (int)((wake - now + 999) / 1000);
+        pfd.fd = fd;
+        pfd.events = POLLIN;
+        if (poll(&pfd, 1, wait_ms) <= 0)
+            continue;
+
+        while(1)
+        {
+            ssize_t n = recv(fd, buf, sizeof(buf), MSG_DONTWAIT);
+            uint32_t idx;
+            request_t *r;
+            ssize_t j;
+
+            if (n < 0)
+                break;
+            if (n < 8 || (buf[0] & 0x0F) != 4)
+                continue;
+            idx = ((uint32_t)buf[4] << 24) | ((uint32_t)buf[5] << 16) | (buf[6] << 8) | buf[7];
+            if (idx >= (uint32_t)next)
+                continue;
+            r = &reqs[idx];
+            if (!r->inflight)
+            {
+                if (r->done)
+                    dup_rsp++;  // late responses to abandoned requests are not counted
+                continue;
+            }
+            r->inflight = false;
+            r->done = true;
+            inflight--;
+            finished++;
+            lat[ok++] = (now_us() - r->first_sent) / 1000.0;
+            // skip the options to find the payload marker
+            j = 8;
+            while (j < n && buf[j] != 0xFF)
+            {
+                uint8_t d = buf[j] >> 4;
+                ssize_t l = buf[j] & 0x0F;
+
+                j++;
+                if (d == 13)
+                    j++;
+                else
+                if (d == 14)
+                    j += 2;
+                if (l == 13)
+                {
+                    l = (j < n) ? buf[j] + 13 : 0;
+                    j++;
+                }
+                else
+                if (l == 14)
+                {
+                    l = (j + 1 < n) ? ((buf[j] << 8) | buf[j+1]) + 269 : 0;
+                    j += 2;
+                }
+                j += l;
+            }
+            if (j + 1 < n)
+                rsp_bytes += n - j - 1;
+        }
+    }
+    elapsed = now_us() - start;
+
+    qsort(lat, ok, sizeof(*lat), cmp_double);
+    printf("requests %d ok %lu failed %lu retransmits %lu dup_rsp %lu\n", count, ok, failed, retransmits, dup_rsp);
+    printf("goodput %.1f B/s %.1f req/s over %.2f s\n",
+        rsp_bytes * 1e6 / elapsed, ok * 1e6 / elapsed, elapsed / 1e6);
+    if (ok > 0)
+        printf("latency ms p50 %.2f p90 %.2f p99 %.2f max %.2f\n",
+            lat[ok * 50 / 100], lat[ok * 90 / 100], lat[ok * 99 / 100], lat[ok - 1]);
+
+    close(fd);
+    free(reqs);
+    free(lat);
+    return 0;
+}
@@ -0,0 +1,44 @@
+#!/bin/sh
+# Runs the POSIX server behind the lossy shim for a set of link profiles and
+# benchmarks it over loopback. The server must be built with: make LOSSY=1
+#
+#   N=1000 sh tools/lossy-scenarios.sh
+
+cd "$(dirname "$0")/.." || exit 1
+BENCH=tools/lossy-bench
+LOG=.lossy-server.log
+N=${N:-500}
+
+run()
+{
+    name=$1
+    spec=$2
+    shift 2
+
+    COAP_LOSSY="$spec" ./coap > $LOG 2>&1 &
+    pid=$!
+    sleep 0.2
+    if ! grep -q '^lossy:' $LOG; then
+        echo "./coap is not built with LOSSY=1"
+        kill $pid
+        exit 1
+    fi
+
+    printf '== %s (%s)\n' "$name" "$spec"
+    $BENCH -n "$N" "$@"
+    kill -INT $pid
+    wait $pid
+    grep '^lossy: handled' $LOG
+}
+
+run clean    "loss=0"
+run loss10   "loss=0.1,seed=1"
+run loss30   "loss=0.3,seed=2"
+run jitter   "delay=20,jitter=40,seed=3"
+run reorder  "reorder=0.2,reorder_delay=30,dup=0.05,seed=4"
+run narrow   "rate=64000,delay=10,seed=5" -w 32
+run lora     "loss=0.2,delay=100,jitter=100,rate=5000,seed=6" -t 1000 -w 4 -n 100
+# NON updates to a resource every profile has
+run non30    "loss=0.3,seed=7" -N -m put -u light -e 1
+
+rm -f $LOG
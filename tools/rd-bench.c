@@ -0,0 +1,122 @@
+// Resource Directory lookup benchmark.
+//
+// Fills the directory through the public API (default 10000 endpoints with
+// 10 links each) and times endpoint and resource lookups through each
+// index, then times expiring everything. Built against the server profile
+// by "make rd-bench".
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "rd.h"
+
+#define ITERATIONS 20000
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+static void run(const char *name, bool res, coap_rd_query_t *q, const char *fmt, int modulo)
+{
+    char val[64], buf[COAP_RD_BLOCK_SIZE];
+    unsigned long results = 0;
+    uint64_t start;
+    size_t len;
+    bool more;
+    int i;
+
+    start = now_ns();
+    for (i=0;i<ITERATIONS;i++)
+    {
+        snprintf(val, sizeof(val), fmt, rand() % modulo);
+        if (0 == strcmp(name, "ep"))
+            q->ep = val;
+        else if (0 == strcmp(name, "d"))
+            q->d = val;
+        else if (0 == strcmp(name, "rt") || 0 == strcmp(name, "rt+d"))
+            q->rt = val;
+        else
+            q->iff = val;
+        if (res)
+            results += coap_rd_lookup_res(q, buf, sizeof(buf), 0, &len, &more);
+        else
+            results += coap_rd_lookup_ep(q, buf, sizeof(buf), 0, &len, &more);
+    }
+    printf("%-4s %-5s lookup %8.2f us  (%.1f results/lookup)\n", res ? "res" : "ep", name,
+        (now_ns() - start) / 1000.0 / ITERATIONS, (double)results / ITERATIONS);
+}
+
+int main(int argc, char **argv)
+{
+    int neps = 10000, nlinks = 10, nrt = 1000, nd = 100, opt, i, j;
+    char ep[32], d[32], *payload;
+    coap_rd_query_t q;
+    uint64_t start;
+    uint32_t id;
+
+    while ((opt = getopt(argc, argv, "e:l:r:d:")) != -1)
+    {
+        switch (opt)
+        {
+            case 'e': neps = atoi(optarg); break;
+            case 'l': nlinks = atoi(optarg); break;
+            case 'r': nrt = atoi(optarg); break;
+            case 'd': nd = atoi(optarg); break;
+            default:
+                fprintf(stderr, "usage: %s [-e endpoints] [-l links_per_ep] [-r rt_values] [-d domains]\n", argv[0]);
+                return 1;
+        }
+    }
+    if (neps <= 0 || nlinks <= 0 || nrt <= 0 || nd <= 0)
+        return 1;
+
+    payload = malloc((size_t)nlinks * 64);
+    coap_rd_setup();
+    coap_rd_tick(1);
+    srand(1);
+
+    start = now_ns();
+    for (i=0;i<neps;i++)
+    {
+        size_t len = 0;
+        for (j=0;j<nlinks;j++)
+            len += sprintf(payload + len, "%s</s/%d>;rt=\"rt%d\";if=\"if%d\"", j ? "," : "", j, rand() % nrt, j % 4);
+        snprintf(ep, sizeof(ep), "node%d", i);
+        snprintf(d, sizeof(d), "dom%d", i % nd);
+        if (COAP_RD_OK != coap_rd_register(ep, d, NULL, 3600, (const uint8_t *)payload, len, &id))
+        {
+            printf("registration %d failed, raise COAP_RD_MAX_EPS/COAP_RD_MAX_LINKS\n", i);
+            return 1;
+        }
+    }
+    printf("registered %d endpoints, %d links in %.1f ms\n", neps, neps * nlinks, (now_ns() - start) / 1e6);
+
+    memset(&q, 0, sizeof(q));
+    run("ep", false, &q, "node%d", neps);
+    memset(&q, 0, sizeof(q));
+    q.count = 10;
+    run("d", false, &q, "dom%d", nd);
+
+    memset(&q, 0, sizeof(q));
+    run("ep", true, &q, "node%d", neps);
+    memset(&q, 0, sizeof(q));
+    run("rt", true, &q, "rt%d", nrt);
+    memset(&q, 0, sizeof(q));
+    q.count = 10;
+    run("if", true, &q, "if%d", 4);
+    memset(&q, 0, sizeof(q));
+    q.d = "dom7";
+    run("rt+d", true, &q, "rt%d", nrt);
+
+    start = now_ns();
+    coap_rd_tick(3601);
+    printf("expired %d endpoints in %.1f ms\n", neps, (now_ns() - start) / 1e6);
+
+    free(payload);
+    return 0;
+}